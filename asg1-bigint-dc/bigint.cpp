@@ -9,6 +9,7 @@ using namespace std;
 #include "bigint.h"
 #include "debug.h"
 #include "relops.h"
+#include "util.h"
 
 bigint::bigint (long that): uvalue (that), is_negative (that < 0) {
    DEBUGF ('~', this << " -> " << uvalue)
@@ -56,14 +57,33 @@ bigint bigint::operator% (const bigint& that) const {
    return result;
 }
 
+bigint bigint::mulmod (const bigint& that,
+                       const bigint& modulus) const {
+   bigint result = uvalue.mulmod (that.uvalue, modulus.uvalue);
+   return result;
+}
+
 bool bigint::operator== (const bigint& that) const {
    return is_negative == that.is_negative and uvalue == that.uvalue;
 }
 
 bool bigint::operator< (const bigint& that) const {
-   if (is_negative != that.is_negative) return is_negative;
-   return is_negative ? uvalue > that.uvalue
-                      : uvalue < that.uvalue;
+   return compare (that) < 0;
+}
+
+int bigint::compare (const bigint& that) const {
+   if (is_negative != that.is_negative) return is_negative ? -1 : 1;
+   int magnitude = uvalue.compare (that.uvalue);
+   return is_negative ? - magnitude : magnitude;
+}
+
+size_t bigint::hash() const {
+   return uvalue.hash() ^ static_cast<size_t> (is_negative);
+}
+
+void bigint::print (digit_writer& writer) const {
+   if (is_negative) writer.put ('-');
+   uvalue.print (writer);
 }
 
 ostream& operator<< (ostream& out, const bigint& that) {
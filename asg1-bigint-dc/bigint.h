@@ -5,6 +5,7 @@
 
 #include <exception>
 #include <iostream>
+#include <functional>
 #include <limits>
 #include <utility>
 using namespace std;
@@ -24,6 +25,9 @@ class bigint {
       bigint (long);
       bigint (const ubigint&, bool is_negative = false);
       explicit bigint (const string&);
+      constexpr bigint (const char* digits, size_t length);
+
+      size_t limbs() const { return uvalue.limbs(); }
 
       bigint operator+() const;
       bigint operator-() const;
@@ -33,10 +37,48 @@ class bigint {
       bigint operator* (const bigint&) const;
       bigint operator/ (const bigint&) const;
       bigint operator% (const bigint&) const;
+      bigint mulmod (const bigint&, const bigint& modulus) const;
 
       bool operator== (const bigint&) const;
       bool operator<  (const bigint&) const;
+      int compare (const bigint&) const;
+      size_t hash() const;
+      void print (digit_writer&) const;
 };
 
+//
+// As in dc, a leading underscore marks a negative literal.
+//
+constexpr bigint::bigint (const char* digits, size_t length):
+   uvalue (length > 0 and digits[0] == '_'
+           ? ubigint (digits + 1, length - 1)
+           : ubigint (digits, length)),
+   is_negative (length > 0 and digits[0] == '_') {
+}
+
+//
+// operator"" _big -
+//    Bigint literal, e.g. "123456789"_big or "_42"_big.  Declare
+//    the result constexpr to have it parsed at compile time:
+//       static constexpr bigint TEN = "10"_big;
+//
+constexpr bigint operator"" _big (const char* digits, size_t length) {
+   return bigint (digits, length);
+}
+
+//
+// hash<bigint> -
+//    Lets bigint be the key of an unordered_map or unordered_set.
+//
+
+namespace std {
+   template <>
+   struct hash<bigint> {
+      size_t operator() (const bigint& value) const {
+         return value.hash();
+      }
+   };
+}
+
 #endif
 
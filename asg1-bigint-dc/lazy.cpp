@@ -0,0 +1,154 @@
+// $Id: lazy.cpp,v 1.1 2016-06-21 15:42:18-07 - - $
+
+#include <functional>
+#include <vector>
+using namespace std;
+
+#include "lazy.h"
+#include "debug.h"
+#include "libfns.h"
+#include "profile.h"
+
+unsigned long expr_dag::next_id = 1;
+unordered_map<string,weak_ptr<expr_node>> expr_dag::literals;
+unordered_map<expr_dag::node_key,weak_ptr<expr_node>,
+              expr_dag::node_key_hash> expr_dag::operations;
+size_t expr_dag::prune_at = 1024;
+
+expr_node::expr_node (unsigned long id, const bigint& value):
+           id(id), oper('\0'), value(value), evaluated(true) {
+}
+
+expr_node::expr_node (unsigned long id, char oper,
+                      const expr_ptr& left, const expr_ptr& right):
+           id(id), oper(oper), left(left), right(right),
+           evaluated(false) {
+}
+
+//
+// Release long chains of operands without recursing once per
+// node:  anything only this node holds is unlinked onto a work
+// list and destroyed with its own operands already detached.
+//
+expr_node::~expr_node() {
+   if (left == nullptr and right == nullptr) return;
+   vector<expr_ptr> doomed;
+   doomed.push_back (move (left));
+   doomed.push_back (move (right));
+   while (not doomed.empty()) {
+      expr_ptr node = move (doomed.back());
+      doomed.pop_back();
+      if (node != nullptr and node.use_count() == 1) {
+         doomed.push_back (move (node->left));
+         doomed.push_back (move (node->right));
+      }
+   }
+}
+
+//
+// evaluate -
+//    Post-order walk with an explicit stack, so a long chain of
+//    pending operators does not recurse.  A % whose left operand
+//    is a * used nowhere else is computed with one mulmod, which
+//    for now gives and costs the same as * then %.
+//
+const bigint& expr_node::evaluate() {
+   vector<expr_node*> pending {this};
+   while (not pending.empty()) {
+      expr_node* node = pending.back();
+      if (node->evaluated) {
+         pending.pop_back();
+         continue;
+      }
+      expr_node* product = node->left.get();
+      bool fuse = node->oper == '%' and product->oper == '*'
+              and not product->evaluated
+              and node->left.use_count() == 1;
+      vector<expr_node*> operands;
+      if (fuse) operands = {product->left.get(), product->right.get(),
+                            node->right.get()};
+           else operands = {node->left.get(), node->right.get()};
+      bool ready = true;
+      for (expr_node* operand: operands) {
+         if (operand->evaluated) continue;
+         pending.push_back (operand);
+         ready = false;
+      }
+      if (not ready) continue;
+      if (fuse) {
+         const bigint& multiplier = product->left->value;
+         const bigint& multiplicand = product->right->value;
+         const bigint& modulus = node->right->value;
+         profile_timer timer ("mulmod", multiplier.limbs()
+                      + multiplicand.limbs() + modulus.limbs());
+         node->value = multiplier.mulmod (multiplicand, modulus);
+      }else {
+         node->value = arith (node->oper, node->left->value,
+                              node->right->value);
+      }
+      DEBUGF ('l', "node " << node->id << " = " << node->value);
+      node->evaluated = true;
+      node->left.reset();
+      node->right.reset();
+      pending.pop_back();
+   }
+   return value;
+}
+
+size_t expr_dag::node_key_hash::operator() (const node_key& key)
+                                           const {
+   hash<unsigned long> hasher;
+   size_t result = hasher (key.left);
+   result = result * 31 + hasher (key.right);
+   return result * 31 + static_cast<unsigned char> (key.oper);
+}
+
+//
+// prune -
+//    Forget table entries whose nodes have died.  Run whenever the
+//    tables have doubled since the last prune, so the cost is
+//    amortized over the insertions.
+//
+void expr_dag::prune() {
+   for (auto itor = literals.begin(); itor != literals.end(); ) {
+      if (itor->second.expired()) itor = literals.erase (itor);
+                             else ++itor;
+   }
+   for (auto itor = operations.begin(); itor != operations.end(); ) {
+      if (itor->second.expired()) itor = operations.erase (itor);
+                             else ++itor;
+   }
+   prune_at = max<size_t> (1024, 2 * (literals.size()
+                                      + operations.size()));
+}
+
+expr_ptr expr_dag::literal (const string& lexinfo) {
+   weak_ptr<expr_node>& entry = literals[lexinfo];
+   expr_ptr node = entry.lock();
+   if (node != nullptr) {
+      profile::record ("cse", {}, 0, 0);
+      return node;
+   }
+   node = make_shared<expr_node> (next_id++, bigint (lexinfo));
+   entry = node;
+   if (literals.size() + operations.size() >= prune_at) prune();
+   return node;
+}
+
+expr_ptr expr_dag::apply (char oper, const expr_ptr& left,
+                          const expr_ptr& right) {
+   node_key key {oper, left->id, right->id};
+   weak_ptr<expr_node>& entry = operations[key];
+   expr_ptr node = entry.lock();
+   if (node != nullptr) {
+      profile::record ("cse", {}, 0, 0);
+      return node;
+   }
+   node = make_shared<expr_node> (next_id++, oper, left, right);
+   entry = node;
+   DEBUGF ('l', "node " << node->id << " = " << left->id << " "
+           << oper << " " << right->id);
+   if (literals.size() + operations.size() >= prune_at) prune();
+   return node;
+}
+
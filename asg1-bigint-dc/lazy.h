@@ -0,0 +1,86 @@
+// $Id: lazy.h,v 1.1 2016-06-21 15:42:18-07 - - $
+
+//
+// Lazy evaluation mode (-l).  Instead of bigint values, the
+// operand stack holds nodes of an expression DAG.  Nothing is
+// computed until a value is printed (p or f).  Identical
+// subexpressions are shared through a hash-consing table, and
+// a * feeding only a % is evaluated as a single mulmod.  With
+// the one-limb ubigint that is exactly * then %; the call is
+// where a multi-limb ubigint would avoid the full product.
+//
+
+#ifndef __LAZY_H__
+#define __LAZY_H__
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+#include "bigint.h"
+
+class expr_node;
+using expr_ptr = shared_ptr<expr_node>;
+
+//
+// expr_node -
+//    A literal (oper == '\0') or a binary operator applied to
+//    two other nodes.  Once evaluated, the operands are released
+//    and only the value is kept.
+//
+
+class expr_node {
+   friend class expr_dag;
+   private:
+      const unsigned long id;
+      const char oper;
+      expr_ptr left;
+      expr_ptr right;
+      bigint value;
+      bool evaluated;
+   public:
+      expr_node (unsigned long id, const bigint& value);
+      expr_node (unsigned long id, char oper,
+                 const expr_ptr& left, const expr_ptr& right);
+      expr_node (const expr_node&) = delete;
+      expr_node& operator= (const expr_node&) = delete;
+      ~expr_node();
+      const bigint& evaluate();
+};
+
+//
+// expr_dag -
+//    static class which creates nodes.  Asking twice for the same
+//    literal or the same operator on the same operands returns
+//    the node already built, as long as it is still alive.
+//
+
+class expr_dag {
+   private:
+      struct node_key {
+         char oper;
+         unsigned long left;
+         unsigned long right;
+         bool operator== (const node_key& that) const {
+            return oper == that.oper and left == that.left
+               and right == that.right;
+         }
+      };
+      struct node_key_hash {
+         size_t operator() (const node_key& key) const;
+      };
+      static unsigned long next_id;
+      static unordered_map<string,weak_ptr<expr_node>> literals;
+      static unordered_map<node_key,weak_ptr<expr_node>,node_key_hash>
+             operations;
+      static size_t prune_at;
+      static void prune();
+   public:
+      static expr_ptr literal (const string& lexinfo);
+      static expr_ptr apply (char oper, const expr_ptr& left,
+                             const expr_ptr& right);
+};
+
+#endif
+
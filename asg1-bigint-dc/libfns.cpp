@@ -1,18 +1,24 @@
 // $Id: libfns.cpp,v 1.4 2015-07-03 14:46:41-07 - - $
 
+#include <stdexcept>
+#include <unordered_map>
+using namespace std;
+
 #include "libfns.h"
+#include "profile.h"
 
 //
 // This algorithm would be more efficient with operators
 // *=, /=2, and is_odd.  But we leave it here.
 //
 
-bigint pow (const bigint& base_arg, const bigint& exponent_arg) {
+static bigint pow_uncached (const bigint& base_arg,
+                            const bigint& exponent_arg) {
    bigint base (base_arg);
    bigint exponent (exponent_arg);
-   static const bigint ZERO (0);
-   static const bigint ONE (1);
-   static const bigint TWO (2);
+   static constexpr bigint ZERO = "0"_big;
+   static constexpr bigint ONE = "1"_big;
+   static constexpr bigint TWO = "2"_big;
    DEBUGF ('^', "base = " << base << ", exponent = " << exponent);
    if (base == ZERO) return ZERO;
    bigint result = ONE;
@@ -22,14 +28,85 @@ bigint pow (const bigint& base_arg, const bigint& exponent_arg) {
    }
    while (exponent > ZERO) {
       if (exponent % TWO == ONE) {
+         profile_timer timer ("pow*", result.limbs() + base.limbs());
          result = result * base;
-         exponent = exponent - 1;
+         exponent = exponent - ONE;
       }else {
+         profile_timer timer ("pow^2", 2 * base.limbs());
          base = base * base;
-         exponent = exponent / 2;
+         exponent = exponent / TWO;
       }
    }
    DEBUGF ('^', "result = " << result);
    return result;
 }
 
+//
+// pow_memo -
+//    Results of recent pow calls, keyed by (base, exponent).
+//    Scripts that raise the same base to the same power over and
+//    over get the answer from here.  The table is emptied when it
+//    reaches pow_memo_limit entries to bound its memory.
+//
+
+struct pow_key {
+   bigint base;
+   bigint exponent;
+   bool operator== (const pow_key& that) const {
+      return base == that.base and exponent == that.exponent;
+   }
+};
+
+struct pow_key_hash {
+   size_t operator() (const pow_key& key) const {
+      hash<bigint> hasher;
+      return hasher (key.base) * 31 + hasher (key.exponent);
+   }
+};
+
+static unordered_map<pow_key,bigint,pow_key_hash> pow_memo;
+static constexpr size_t pow_memo_limit = 4096;
+
+bigint pow (const bigint& base, const bigint& exponent) {
+   pow_key key {base, exponent};
+   auto found = pow_memo.find (key);
+   if (found != pow_memo.end()) {
+      profile::record ("pow$", {}, found->second.limbs(), 0);
+      return found->second;
+   }
+   bigint result = pow_uncached (base, exponent);
+   if (pow_memo.size() >= pow_memo_limit) pow_memo.clear();
+   pow_memo.emplace (key, result);
+   return result;
+}
+
+//
+// opername -
+//    The profile name of an operator, as a string literal.
+//
+static const char* opername (const char oper) {
+   switch (oper) {
+      case '+': return "+";
+      case '-': return "-";
+      case '*': return "*";
+      case '/': return "/";
+      case '%': return "%";
+      case '^': return "^";
+      default: return "?";
+   }
+}
+
+bigint arith (const char oper, const bigint& left,
+              const bigint& right) {
+   profile_timer timer (opername (oper), left.limbs() + right.limbs());
+   switch (oper) {
+      case '+': return left + right;
+      case '-': return left - right;
+      case '*': return left * right;
+      case '/': return left / right;
+      case '%': return left % right;
+      case '^': return pow (left, right);
+      default: throw invalid_argument ("arith operator "s + oper);
+   }
+}
+
@@ -1,8 +1,27 @@
-// $Id: libfns.h,v 1.2 2015-07-02 16:03:36-07 - - $
+// $Id: libfns.h,v 1.3 2016-06-20 12:10:04-07 - - $
 
 // Library functions not members of any class.
 
+#ifndef __LIBFNS_H__
+#define __LIBFNS_H__
+
 #include "bigint.h"
 
+//
+// pow -
+//    base ^ exponent.  Recent (base, exponent) pairs are memoized.
+//
+
 bigint pow (const bigint& base, const bigint& exponent);
 
+//
+// arith -
+//    Apply one of the binary dc operators + - * / % ^ to a pair
+//    of operands.  Shared by the eager stack and the lazy DAG.
+//
+
+bigint arith (const char oper, const bigint& left,
+              const bigint& right);
+
+#endif
+
@@ -1,6 +1,7 @@
 // $Id: main.cpp,v 1.54 2016-06-14 18:19:17-07 - - $
 
 #include <cassert>
+#include <cstdio>
 #include <deque>
 #include <iostream>
 #include <stdexcept>
@@ -13,11 +14,15 @@ using namespace std;
 #include "bigint.h"
 #include "debug.h"
 #include "iterstack.h"
+#include "lazy.h"
 #include "libfns.h"
+#include "profile.h"
 #include "scanner.h"
 #include "util.h"
 
 using bigint_stack = iterstack<bigint>;
+using lazy_stack = iterstack<expr_ptr>;
+bool lazy_mode = false;
 
 void do_arith (bigint_stack& stack, const char oper) {
    if (stack.size() < 2) throw ydc_exn ("stack empty");
@@ -27,16 +32,7 @@ void do_arith (bigint_stack& stack, const char oper) {
    bigint left = stack.top();
    stack.pop();
    DEBUGF ('d', "left = " << left);
-   bigint result;
-   switch (oper) {
-      case '+': result = left + right; break;
-      case '-': result = left - right; break;
-      case '*': result = left * right; break;
-      case '/': result = left / right; break;
-      case '%': result = left % right; break;
-      case '^': result = pow (left, right); break;
-      default: throw invalid_argument ("do_arith operator "s + oper);
-   }
+   bigint result = arith (oper, left, right);
    DEBUGF ('d', "result = " << result);
    stack.push (result);
 }
@@ -53,27 +49,76 @@ void do_dup (bigint_stack& stack, const char) {
    stack.push (top);
 }
 
+//
+// print_value -
+//    Digits go straight into cout's buffer as they are converted.
+//    No flush, so a long run of prints costs no extra syscalls.
+//
+void print_value (const bigint& value) {
+   digit_writer writer (cout);
+   value.print (writer);
+   writer.newline();
+}
+
 void do_printall (bigint_stack& stack, const char) {
-   for (const auto& elem: stack) cout << elem << endl;
+   for (const auto& elem: stack) print_value (elem);
 }
 
 void do_print (bigint_stack& stack, const char) {
-   cout << stack.top() << endl;
+   print_value (stack.top());
 }
 
-void do_debug (bigint_stack& stack, const char) {
+template <typename stack_t>
+void do_debug (stack_t& stack, const char) {
    (void) stack; // SUPPRESS: warning: unused parameter 'stack'
-   cout << "Y not implemented" << endl;
+   if (not profile::enabled) throw ydc_exn ("Y: profiling is off (-@p)");
+   profile::report (cout);
 }
 
 class ydc_quit: public exception {};
-void do_quit (bigint_stack&, const char) {
+template <typename stack_t>
+void do_quit (stack_t&, const char) {
    throw ydc_quit();
 }
 
-using function_t = void (*)(bigint_stack&, const char);
-using fn_hash = unordered_map<string,function_t>;
-fn_hash do_functions = {
+//
+// Lazy mode versions of the stack functions.  Operators only
+// build DAG nodes; values are computed when printed.
+//
+
+void lazy_arith (lazy_stack& stack, const char oper) {
+   if (stack.size() < 2) throw ydc_exn ("stack empty");
+   expr_ptr right = stack.top();
+   stack.pop();
+   expr_ptr left = stack.top();
+   stack.pop();
+   stack.push (expr_dag::apply (oper, left, right));
+}
+
+void lazy_clear (lazy_stack& stack, const char) {
+   DEBUGF ('d', "");
+   stack.clear();
+}
+
+void lazy_dup (lazy_stack& stack, const char) {
+   expr_ptr top = stack.top();
+   stack.push (top);
+}
+
+void lazy_printall (lazy_stack& stack, const char) {
+   for (const auto& elem: stack) print_value (elem->evaluate());
+}
+
+void lazy_print (lazy_stack& stack, const char) {
+   print_value (stack.top()->evaluate());
+}
+
+template <typename stack_t>
+using function_t = void (*)(stack_t&, const char);
+template <typename stack_t>
+using fn_hash = unordered_map<string,function_t<stack_t>>;
+
+fn_hash<bigint_stack> do_functions = {
    {"+"s, do_arith},
    {"-"s, do_arith},
    {"*"s, do_arith},
@@ -88,20 +133,51 @@ fn_hash do_functions = {
    {"q"s, do_quit},
 };
 
-
+fn_hash<lazy_stack> lazy_functions = {
+   {"+"s, lazy_arith},
+   {"-"s, lazy_arith},
+   {"*"s, lazy_arith},
+   {"/"s, lazy_arith},
+   {"%"s, lazy_arith},
+   {"^"s, lazy_arith},
+   {"Y"s, do_debug},
+   {"c"s, lazy_clear},
+   {"d"s, lazy_dup},
+   {"f"s, lazy_printall},
+   {"p"s, lazy_print},
+   {"q"s, do_quit},
+};
+
+template <typename stack_t>
+void do_operator (fn_hash<stack_t>& functions, stack_t& stack,
+                  const string& lexinfo) {
+   auto fn = functions.find (lexinfo);
+   if (fn == functions.end()) {
+      throw ydc_exn (octal (lexinfo[0]) + " is unimplemented");
+   }
+   fn->second (stack, lexinfo.at(0));
+}
+
+
 //
 // scan_options
-//    Options analysis:  The only option is -Dflags. 
+//    Options analysis:  -@flags sets debug flags.  The flag 'p'
+//    turns on profiling, and prints the report (see the Y command)
+//    at exit.
+//    -l selects lazy evaluation (see lazy.h).
 //
 void scan_options (int argc, char** argv) {
    opterr = 0;
    for (;;) {
-      int option = getopt (argc, argv, "@:");
+      int option = getopt (argc, argv, "@:l");
       if (option == EOF) break;
       switch (option) {
          case '@':
             debugflags::setflags (optarg);
             break;
+         case 'l':
+            lazy_mode = true;
+            break;
          default:
             error() << "-" << static_cast<char> (optopt)
                     << ": invalid option" << endl;
@@ -111,6 +187,7 @@ void scan_options (int argc, char** argv) {
    if (optind < argc) {
       error() << "operand not permitted" << endl;
    }
+   profile::enabled = debugflags::getflag ('p');
 }
 
 
@@ -120,7 +197,14 @@ void scan_options (int argc, char** argv) {
 int main (int argc, char** argv) {
    exec::execname (argv[0]);
    scan_options (argc, argv);
+   // When not talking to a terminal, use a large output buffer so
+   // huge results are written in a few big blocks.
+   constexpr size_t output_buffer_size = 1 << 20;
+   if (not isatty (fileno (stdout))) {
+      setvbuf (stdout, nullptr, _IOFBF, output_buffer_size);
+   }
    bigint_stack operand_stack;
+   lazy_stack lazy_operands;
    scanner input;
    try {
       for (;;) {
@@ -130,19 +214,26 @@ int main (int argc, char** argv) {
                case tsymbol::SCANEOF:
                   throw ydc_quit();
                   break;
-               case tsymbol::NUMBER:
-                  operand_stack.push (bigint (lexeme.lexinfo));
-                  break;
-               case tsymbol::OPERATOR: {
-                  fn_hash::const_iterator fn
-                           = do_functions.find (lexeme.lexinfo);
-                  if (fn == do_functions.end()) {
-                     throw ydc_exn (octal (lexeme.lexinfo[0])
-                                    + " is unimplemented");
+               case tsymbol::NUMBER: {
+                  profile_timer timer ("number");
+                  if (lazy_mode) {
+                     lazy_operands.push (
+                              expr_dag::literal (lexeme.lexinfo));
+                  }else {
+                     operand_stack.push (bigint (lexeme.lexinfo));
+                     timer.add_limbs (operand_stack.top().limbs());
                   }
-                  fn->second (operand_stack, lexeme.lexinfo.at(0));
                   break;
                   }
+               case tsymbol::OPERATOR:
+                  if (lazy_mode) {
+                     do_operator (lazy_functions, lazy_operands,
+                                  lexeme.lexinfo);
+                  }else {
+                     do_operator (do_functions, operand_stack,
+                                  lexeme.lexinfo);
+                  }
+                  break;
                default:
                   assert (false);
             }
@@ -153,6 +244,7 @@ int main (int argc, char** argv) {
    }catch (ydc_quit&) {
       // Intentionally left empty.
    }
+   if (profile::enabled) profile::report (cerr);
    return exec::status();
 }
 
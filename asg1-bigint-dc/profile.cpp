@@ -0,0 +1,77 @@
+// $Id: profile.cpp,v 1.1 2016-06-20 12:10:04-07 - - $
+
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <new>
+using namespace std;
+
+#include "profile.h"
+
+unordered_map<const char*,profile::stats> profile::table;
+bool profile::enabled = false;
+size_t profile::allocations = 0;
+
+//
+// Replacements for the global allocation functions, so that
+// every heap allocation, including those inside the standard
+// containers, is counted.  The array and sized forms all forward
+// to these.
+//
+
+void* operator new (size_t size) {
+   ++profile::allocations;
+   void* block = malloc (size == 0 ? 1 : size);
+   if (block == nullptr) throw bad_alloc();
+   return block;
+}
+
+void operator delete (void* block) noexcept {
+   free (block);
+}
+
+void operator delete (void* block, size_t) noexcept {
+   free (block);
+}
+
+void profile::record (const char* oper, clock::duration time,
+                      size_t limbs, size_t allocs) {
+   if (not enabled) return;
+   stats& entry = table[oper];
+   ++entry.count;
+   entry.time += time;
+   entry.limbs += limbs;
+   entry.allocs += allocs;
+}
+
+void profile::report (ostream& out) {
+   using seconds = chrono::duration<double>;
+   out << setw (8) << left << "oper" << right
+       << setw (12) << "count" << setw (14) << "seconds"
+       << setw (12) << "limbs" << setw (12) << "allocs" << endl;
+   // The same name may be two literals at two addresses.
+   map<string,stats> by_name;
+   for (const auto& entry: table) {
+      stats& stat = by_name[entry.first];
+      stat.count += entry.second.count;
+      stat.time += entry.second.time;
+      stat.limbs += entry.second.limbs;
+      stat.allocs += entry.second.allocs;
+   }
+   for (const auto& entry: by_name) {
+      const stats& stat = entry.second;
+      out << setw (8) << left << entry.first << right
+          << setw (12) << stat.count
+          << setw (14) << fixed << setprecision (6)
+          << chrono::duration_cast<seconds> (stat.time).count()
+          << setw (12) << stat.limbs << setw (12) << stat.allocs
+          << endl;
+   }
+   out.unsetf (ios::floatfield);
+}
+
+void profile_timer::stop() {
+   profile::record (oper, profile::clock::now() - start, limbs,
+                    profile::allocations - allocs_at_start);
+}
+
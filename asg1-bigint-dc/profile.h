@@ -0,0 +1,77 @@
+// $Id: profile.h,v 1.1 2016-06-20 12:10:04-07 - - $
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+//
+// profile -
+//    static class for gathering per-operation statistics.  Each
+//    sample is keyed by an operation name and accumulates a count,
+//    the elapsed time, the size of the operands in limbs, and the
+//    number of heap allocations made while it ran.  Names must be
+//    string literals: the table is keyed by their address, so a
+//    sample neither builds nor hashes a string.
+// enabled -
+//    Set by the 'p' debug flag (-@p).  Nothing is timed or
+//    recorded otherwise.
+// report -
+//    Prints one line per operation.  Used by the Y command, and
+//    at exit when profiling is enabled.
+// allocations -
+//    Running count of calls to the global operator new.
+//
+
+class profile {
+   public:
+      using clock = chrono::steady_clock;
+      struct stats {
+         size_t count {};
+         clock::duration time {};
+         size_t limbs {};
+         size_t allocs {};
+      };
+   private:
+      static unordered_map<const char*,stats> table;
+   public:
+      static bool enabled;
+      static size_t allocations;
+      static void record (const char* oper, clock::duration time,
+                          size_t limbs, size_t allocs);
+      static void report (ostream& out);
+      static void clear() { table.clear(); }
+};
+
+//
+// profile_timer -
+//    Times a region of code and records it when it goes out of
+//    scope, if profiling is enabled.  Operand sizes are added with
+//    add_limbs as they are discovered.  Example:
+//       profile_timer timer ("+", left.limbs() + right.limbs());
+//
+
+class profile_timer {
+   private:
+      const char* oper;
+      size_t limbs;
+      size_t allocs_at_start {profile::allocations};
+      profile::clock::time_point start {profile::enabled
+                       ? profile::clock::now()
+                       : profile::clock::time_point()};
+      void stop();
+   public:
+      profile_timer (const char* oper, size_t limbs = 0):
+                     oper(oper), limbs(limbs) {}
+      profile_timer (const profile_timer&) = delete;
+      profile_timer& operator= (const profile_timer&) = delete;
+      ~profile_timer() { if (profile::enabled) stop(); }
+      void add_limbs (size_t more) { limbs += more; }
+};
+
+#endif
+
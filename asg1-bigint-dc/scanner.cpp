@@ -10,6 +10,7 @@ using namespace std;
 
 #include "scanner.h"
 #include "debug.h"
+#include "profile.h"
 
 char scanner::get() {
    if (not good()) throw runtime_error ("scanner::get() past EOF"); 
@@ -19,6 +20,7 @@ char scanner::get() {
 }
 
 token scanner::scan() {
+   profile_timer timer ("scan");
    while (good() and isspace (nextchar)) get();
    if (not good()) return {tsymbol::SCANEOF};
    if (nextchar == '_' or isdigit (nextchar)) {
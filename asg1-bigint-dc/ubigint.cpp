@@ -8,6 +8,7 @@ using namespace std;
 
 #include "ubigint.h"
 #include "debug.h"
+#include "util.h"
 
 ubigint::ubigint (unsigned long that): uvalue (that) {
    DEBUGF ('~', this << " -> " << uvalue)
@@ -43,6 +44,10 @@ void ubigint::divide_by_2() {
    uvalue /= 2;
 }
 
+size_t ubigint::limbs() const {
+   return uvalue == 0 ? 0 : 1;
+}
+
 
 struct quo_rem { ubigint quotient; ubigint remainder; };
 quo_rem udivide (const ubigint& dividend, ubigint divisor) {
@@ -75,6 +80,20 @@ ubigint ubigint::operator% (const ubigint& that) const {
    return udivide (*this, that).remainder;
 }
 
+//
+// mulmod -
+//    (this * that) % modulus, computed exactly as operator*
+//    then operator%, product wrapping included, so the lazy
+//    mode's fused * and % prints what eager mode does.  A hook
+//    for a multi-limb ubigint, which could reduce as it goes.
+//
+ubigint ubigint::mulmod (const ubigint& that,
+                         const ubigint& modulus) const {
+   if (modulus.uvalue == 0) throw domain_error ("mulmod by zero");
+   unumber product = uvalue * that.uvalue;
+   return ubigint (product % modulus.uvalue);
+}
+
 bool ubigint::operator== (const ubigint& that) const {
    return uvalue == that.uvalue;
 }
@@ -83,6 +102,62 @@ bool ubigint::operator< (const ubigint& that) const {
    return uvalue < that.uvalue;
 }
 
+//
+// compare -
+//    Three-way comparison in one pass over the limbs, most
+//    significant first:  negative, zero, or positive as this is
+//    less than, equal to, or greater than that.
+//
+int ubigint::compare (const ubigint& that) const {
+   if (uvalue != that.uvalue) return uvalue < that.uvalue ? -1 : 1;
+   return 0;
+}
+
+//
+// hash -
+//    Mixes the limbs directly (splitmix64 finalizer per limb), so
+//    no conversion to a string is needed to key a hash table.
+//
+size_t ubigint::hash() const {
+   unumber mixed = uvalue + 0x9E3779B97F4A7C15UL;
+   mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9UL;
+   mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBUL;
+   return mixed ^ (mixed >> 31);
+}
+
+//
+// print -
+//    Decimal digits in chunks of chunk_digits, most significant
+//    chunk first, each handed to the writer as soon as it is
+//    formatted.  The whole decimal string is never built.
+//
+void ubigint::print (digit_writer& writer) const {
+   constexpr int chunk_digits = 9;
+   constexpr unumber chunk_base = 1000000000;
+   constexpr int max_chunks = numeric_limits<unumber>::digits10
+                            / chunk_digits + 1;
+   unumber chunks[max_chunks];
+   int count = 0;
+   unumber rest = uvalue;
+   do {
+      chunks[count++] = rest % chunk_base;
+      rest /= chunk_base;
+   }while (rest > 0);
+   char digits[chunk_digits];
+   for (int chunk = count - 1; chunk >= 0; --chunk) {
+      unumber value = chunks[chunk];
+      int first = chunk_digits;
+      do {
+         digits[--first] = '0' + value % 10;
+         value /= 10;
+      }while (value > 0);
+      if (chunk != count - 1) {
+         while (first > 0) digits[--first] = '0';
+      }
+      writer.put (digits + first, chunk_digits - first);
+   }
+}
+
 ostream& operator<< (ostream& out, const ubigint& that) { 
    return out << "ubigint(" << that.uvalue << ")";
 }
@@ -6,12 +6,15 @@
 #include <exception>
 #include <iostream>
 #include <limits>
+#include <stdexcept>
 #include <utility>
 using namespace std;
 
 #include "debug.h"
 #include "relops.h"
 
+class digit_writer;
+
 class ubigint {
    friend ostream& operator<< (ostream&, const ubigint&);
    private:
@@ -20,20 +23,47 @@ class ubigint {
    public:
       void multiply_by_2();
       void divide_by_2();
+      size_t limbs() const;
 
       ubigint() = default; // Need default ctor as well.
       ubigint (unsigned long);
       ubigint (const string&);
+      constexpr ubigint (const char* digits, size_t length);
 
       ubigint operator+ (const ubigint&) const;
       ubigint operator- (const ubigint&) const;
       ubigint operator* (const ubigint&) const;
       ubigint operator/ (const ubigint&) const;
       ubigint operator% (const ubigint&) const;
+      ubigint mulmod (const ubigint&, const ubigint& modulus) const;
 
       bool operator== (const ubigint&) const;
       bool operator<  (const ubigint&) const;
+      int compare (const ubigint&) const;
+      size_t hash() const;
+      void print (digit_writer&) const;
 };
 
+//
+// Parse a string of decimal digits without going through string.
+// When used in a constant expression the work is done by the
+// compiler, and a bad digit or a value too large to fit is a
+// compile-time error rather than a silent wraparound.
+//
+constexpr ubigint::ubigint (const char* digits, size_t length) {
+   constexpr unumber max_value = numeric_limits<unumber>::max();
+   for (size_t index = 0; index < length; ++index) {
+      char digit = digits[index];
+      if (digit < '0' or digit > '9') {
+         throw invalid_argument ("ubigint: bad digit in literal");
+      }
+      unumber value = digit - '0';
+      if (uvalue > (max_value - value) / 10) {
+         throw overflow_error ("ubigint: literal too large");
+      }
+      uvalue = uvalue * 10 + value;
+   }
+}
+
 #endif
 
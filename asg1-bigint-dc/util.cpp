@@ -1,5 +1,6 @@
 // $Id: util.cpp,v 1.1 2016-06-14 18:19:17-07 - - $
 
+#include <algorithm>
 #include <cstring>
 using namespace std;
 
@@ -8,6 +9,25 @@ using namespace std;
 ydc_exn::ydc_exn (const string& what): runtime_error (what) {
 }
 
+void digit_writer::put (const char* chars, size_t count) {
+   while (count > 0) {
+      if (column == line_width - 1) {
+         out.write ("\\\n", 2);
+         column = 0;
+      }
+      size_t room = min (count, line_width - 1 - column);
+      out.write (chars, room);
+      column += room;
+      chars += room;
+      count -= room;
+   }
+}
+
+void digit_writer::newline() {
+   out.put ('\n');
+   column = 0;
+}
+
 string exec::execname_; // Must be initialized from main().
 int exec::status_ = EXIT_SUCCESS;
 
@@ -42,6 +42,27 @@ const string octal (numeric number) {
 }
 
 
+//
+// digit_writer -
+//    Streams the digits of a number to an ostream as they are
+//    produced, most significant first, wrapping lines as dc does:
+//    a backslash and newline after every line_width - 1 chars.
+//    Nothing is flushed; a number ends with newline().
+//
+
+class digit_writer {
+   private:
+      ostream& out;
+      size_t column {0};
+   public:
+      static constexpr size_t line_width = 70;
+      explicit digit_writer (ostream& out): out(out) {}
+      void put (const char* chars, size_t count);
+      void put (char chr) { put (&chr, 1); }
+      void newline();
+};
+
+
 //
 // main -
 //    Keep track of execname and exit status.  Must be initialized
@@ -1,21 +1,41 @@
 // $Id: commands.cpp,v 1.16 2016-01-14 16:10:40-08 - - $
 
+#include <algorithm>
+#include <cstring>
+#include <regex>
+#include <sstream>
+#include <unordered_set>
+
 #include "commands.h"
 #include "debug.h"
+#include "journal.h"
+#include "pool.h"
 
 command_hash cmd_hash {
     {"cat"   , fn_cat   },
     {"cd"    , fn_cd    },
+    {"cp"    , fn_cp    },
+    {"df"    , fn_df    },
+    {"du"    , fn_du    },
     {"echo"  , fn_echo  },
     {"exit"  , fn_exit  },
+    {"find"  , fn_find  },
+    {"grep"  , fn_grep  },
+    {"load"  , fn_load  },
     {"ls"    , fn_ls    },
     {"lsr"   , fn_lsr   },
     {"make"  , fn_make  },
+    {"mem"   , fn_mem   },
     {"mkdir" , fn_mkdir },
+    {"mv"    , fn_mv    },
     {"prompt", fn_prompt},
     {"pwd"   , fn_pwd   },
+    {"restore", fn_restore},
     {"rm"    , fn_rm    },
     {"rmr"   , fn_rmr   },
+    {"save"  , fn_save  },
+    {"snapshot", fn_snapshot},
+    {"sync"  , fn_sync  },
     {"#"     , fn_com   },
 };
 
@@ -30,43 +50,56 @@ command_fn find_command_fn (const string& cmd) {
     return result->second;
 }
 
-string get_parent_path(const wordvec& pathvec, bool from_root){
-    string parent_path = from_root? "/" : "";
-    for (int i = 0; i < ((int)pathvec.size())-1; i++) {
-        parent_path.append(pathvec[i]);
-        parent_path.append("/");
+/**
+ * Resolves the first length characters of a path, one component at a
+ * time, straight from the string: no wordvec of components, and no
+ * string per component once the buffer has grown to the longest name.
+ * Empty components are skipped; no components at all is the cwd, or
+ * the root for a path starting with "/".
+ */
+static inode_ptr resolve_path (inode_state& state, const string& path,
+                               size_t length = string::npos){
+    // Reused by every call; commands run one at a time.
+    static string component;
+    length = min(length, path.size());
+    inode_ptr node = length > 0 && path[0] == '/' ? state.get_root() : state.get_cwd();
+    size_t end = 0;
+    for (;;) {
+        size_t begin = end;
+        while (begin < length && path[begin] == '/') {
+            ++begin;
+        }
+        if (begin == length) {
+            return node;
+        }
+        end = begin;
+        while (end < length && path[end] != '/') {
+            ++end;
+        }
+        // Each step answered by the dentry cache when possible.
+        component.assign(path, begin, end - begin);
+        node = node->lookup(component);
     }
-    return parent_path;
 }
 
-inode_ptr trace_path (inode_state& state, const wordvec& words){
-    // Get strings ready
-    string toCheck = "";
-    if (words.size() >=2) {
-         toCheck = words[1];
-    }
-    wordvec path = split (toCheck, "/");
-    
-    // Set to cwd since no path provided
-    if (path.size() == 0) {
-        return state.get_cwd();
-    }
-    
-    // Create variables
-    directory_ptr access;
-    
-    // Get access
-    access = toCheck.front() == '/'?
-    state.get_root()->get_directory_access() :
-    state.get_cwd()->get_directory_access();
-    
-    // Access path
-    for (int i = 0; i < path.size()-1; i++) {
-        access = access->get_dir_in_dirents(path[i]);
+/**
+ * Resolves the directory a path names an entry in, and sets name to
+ * the entry's name, the last component. Only name is copied.
+ */
+static inode_ptr resolve_parent (inode_state& state, const string& path, string& name){
+    size_t end = path.find_last_not_of('/');
+    if (end == string::npos) {
+        throw file_error("Invalid argument");
     }
-    
-    // Get destination inode_ptr
-    return access->get_inode_in_dirents(path.back());
+    size_t begin = path.rfind('/', end);
+    begin = begin == string::npos ? 0 : begin + 1;
+    name.assign(path, begin, end + 1 - begin);
+    return resolve_path(state, path, begin);
+}
+
+inode_ptr trace_path (inode_state& state, const wordvec& words){
+    static const string none;
+    return resolve_path(state, words.size() >= 2 ? words[1] : none);
 }
 
 command_error::command_error (const string& what):runtime_error (what) {
@@ -85,7 +118,8 @@ void fn_cat (inode_state& state, const wordvec& words){
             throw file_error("Is not a file.");
         }
         plain_file_ptr file = trace_path(state,words)->get_plain_file_access();
-        cout << file->readfile()[1] << endl;
+        file->write_to(cout);
+        cout << endl;
     } catch(file_error& error){
         cout << "cat: " << words[1] << ": "<< error.what() << endl;
     }
@@ -103,6 +137,79 @@ void fn_cd (inode_state& state, const wordvec& words){
     }
 }
 
+/**
+ * cp [-r] SRC DST. Into DST if it is a directory, else to the name DST.
+ * Directories need -r; either way the copy is O(1) and shares with the
+ * source until one of them changes.
+ */
+void fn_cp (inode_state& state, const wordvec& words){
+    try{
+        bool recursive = words.size() > 1 && words[1] == "-r";
+        size_t first = recursive ? 2 : 1;
+        if (words.size() != first + 2) {
+            throw file_error("Missing file operand");
+        }
+        const string& source_path = words[first];
+        const string& target_path = words[first + 1];
+        if (source_path == "/") {
+            throw file_error("Invalid argument");
+        }
+        inode_ptr source = resolve_path(state, source_path);
+        if (source->get_this_type() == file_type::DIRECTORY_TYPE && !recursive) {
+            throw file_error(source_path + ": Is a directory");
+        }
+        inode_ptr target = nullptr;
+        try {
+            target = resolve_path(state, target_path);
+        } catch (file_error&) {
+            // Not there yet: copy to that name.
+        }
+        if (target == nullptr) {
+            string name;
+            inode_ptr parent = resolve_parent(state, target_path, name);
+            parent->get_directory_access()->mkcopy(name, source, parent);
+        } else if (target->get_this_type() == file_type::DIRECTORY_TYPE) {
+            target->get_directory_access()->mkcopy(source->get_name(), source, target);
+        } else if (source->get_this_type() == file_type::PLAIN_TYPE) {
+            target->make_writable();
+            size_t old_size = target->get_size();
+            target->get_plain_file_access()->copy_from(*source->get_plain_file_access());
+            target->resized(old_size);
+        } else {
+            throw file_error(target_path + ": Not a directory");
+        }
+    } catch (file_error& error){
+        cout << "cp: " << error.what() << endl;
+    }
+}
+
+void fn_df (inode_state&, const wordvec&){
+    reclaimer::finish();
+    // Unsealed tails are not shared, so they count in both columns.
+    size_t unsealed = mem_stats::get_data();
+    cout << "logical\tphysical\tblobs" << endl;
+    cout << blob_store::get_logical() + unsealed << "\t"
+         << blob_store::get_physical() + unsealed << "\t"
+         << blob_store::size() << endl;
+}
+
+/**
+ * du [PATH] prints the bytes in the files under PATH and the number of
+ * inodes there, from the totals kept per directory.
+ */
+void fn_du (inode_state& state, const wordvec& words){
+    try{
+        inode_ptr node = words.size() > 1 && words[1] == "/" ?
+                         state.get_root() : trace_path(state, words);
+        inode::settle_totals();
+        subtree_totals totals = node->get_totals();
+        string path = node->get_full_path();
+        cout << totals.bytes << "\t" << totals.inodes << "\t" << path << endl;
+    } catch(file_error& error){
+        cout << "du: " << (words.size() > 1 ? words[1] + ": " : "") << error.what() << endl;
+    }
+}
+
 void fn_echo (inode_state& state, const wordvec& words){
     cout << word_range (words.cbegin() + 1, words.cend()) << endl;
 }
@@ -112,11 +219,200 @@ void fn_exit (inode_state& state, const wordvec& words){
     throw ysh_exit();
 }
 
+/**
+ * find [PATH] -name PATTERN prints the paths below PATH, or the cwd,
+ * whose last component matches PATTERN, which may be a glob.
+ */
+void fn_find (inode_state& state, const wordvec& words){
+    try{
+        size_t option = words.size() == 3 ? 1 : 2;
+        if (words.size() < 3 || words.size() > 4 || words[option] != "-name") {
+            throw file_error("usage: find [PATH] -name PATTERN");
+        }
+        inode_ptr start = option == 1 ? state.get_cwd() :
+                          words[1] == "/" ? state.get_root() : trace_path(state, words);
+        for (const auto& path: start->find_names(words[option + 1])) {
+            cout << path << "\n";
+        }
+        cout.flush();
+    } catch(file_error& error){
+        cout << "find: " << error.what() << endl;
+    }
+}
+
+/**
+ * The longest run of plain characters every match of a regex must
+ * contain, or "" if there is none to be sure of. Anything inside
+ * brackets, braces or a group, escaped, or made optional by the
+ * quantifier after it ends a run.
+ */
+static string required_literal (const string& pattern) {
+    if (pattern.find('|') != string::npos) {
+        return "";
+    }
+    string best;
+    string run;
+    int depth = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        char chr = pattern[i];
+        bool optional = i + 1 < pattern.size() && strchr("?*{", pattern[i + 1]) != nullptr;
+        if (chr == '\\') {
+            ++i;
+        } else if (chr == '[') {
+            i = pattern.find(']', i + (i + 1 < pattern.size() && pattern[i + 1] == '^' ? 3 : 2));
+        } else if (chr == '{') {
+            i = pattern.find('}', i);
+        } else if (chr == '(') {
+            ++depth;
+        } else if (chr == ')') {
+            --depth;
+        } else if (depth == 0 && !optional && strchr(".^$*+?", chr) == nullptr) {
+            run += chr;
+            if (run.size() > best.size()) {
+                best = run;
+            }
+            continue;
+        }
+        if (i == string::npos) {
+            break;
+        }
+        run.clear();
+    }
+    return best;
+}
+
+/**
+ * The tokens a file must hold whole to contain text. A run of token
+ * characters at either end of text may be part of a longer token in
+ * the file, so only the ones bounded on both sides count.
+ */
+static wordvec whole_tokens (const string& text) {
+    size_t first = 0;
+    size_t last = text.size();
+    while (first < last && is_word_char(text[first])) {
+        ++first;
+    }
+    while (last > first && is_word_char(text[last - 1])) {
+        --last;
+    }
+    return content_index::tokenize(text.substr(first, last - first));
+}
+
+/**
+ * grep's PATTERN: words[1], or, if that starts with a double quote,
+ * the words up to the one that ends with the closing quote, rejoined
+ * with single spaces and unquoted. Sets next to the word after it,
+ * the PATH operand if there is one. False if the quote is not closed.
+ */
+static bool grep_pattern (const wordvec& words, string& pattern, size_t& next) {
+    pattern = words[1];
+    next = 2;
+    if (pattern.front() != '"') {
+        return true;
+    }
+    while (pattern.size() < 2 || pattern.back() != '"') {
+        if (next == words.size()) {
+            return false;
+        }
+        pattern += " " + words[next++];
+    }
+    pattern = pattern.substr(1, pattern.size() - 2);
+    return true;
+}
+
+/**
+ * Prints the lines of text holding a match as path:line. Candidate
+ * lines are found by searching the whole text for needle, with
+ * string::find, which comes down to memchr, so lines without it are
+ * never looked at; matches() then decides each candidate line.
+ */
+static void print_matches (const string& path, const string& text, const string& needle,
+                           const function<bool(const string&, size_t)>& matches) {
+    size_t pos = needle.empty() ? 0 : text.find(needle);
+    while (pos < text.size()) {
+        size_t begin = text.rfind('\n', pos);
+        begin = begin == string::npos ? 0 : begin + 1;
+        size_t end = text.find('\n', pos);
+        end = end == string::npos ? text.size() : end;
+        // Leave out the separator space make and append end a line with.
+        size_t length = end - begin - (end > begin && text[end - 1] == ' ' ? 1 : 0);
+        string line = text.substr(begin, length);
+        if (pos - begin <= length && matches(line, pos - begin)) {
+            cout << path << ":" << line << "\n";
+        }
+        pos = needle.empty() ? end + 1 : text.find(needle, end);
+    }
+}
+
+/**
+ * grep PATTERN [PATH] prints the lines of the files at or below PATH,
+ * or the cwd, that match, as path:line. PATTERN may be quoted to hold
+ * spaces. With any of .^$*+?()[]{}|\ in it, it is a regex; otherwise
+ * it is matched literally. Either way it may match anywhere in a line.
+ * The content_index picks the files holding every token that a match
+ * must contain whole, if there are any.
+ */
+void fn_grep (inode_state& state, const wordvec& words){
+    try{
+        string pattern;
+        size_t next;
+        if (words.size() < 2 || !grep_pattern(words, pattern, next) || words.size() > next + 1) {
+            throw file_error("usage: grep PATTERN [PATH]");
+        }
+        inode_ptr start = words.size() == next ? state.get_cwd() :
+                          resolve_path(state, words[next]);
+        bool literal = pattern.find_first_of(".^$*+?()[]{}|\\") == string::npos;
+        regex expression;
+        if (!literal) {
+            try {
+                expression = regex(pattern);
+            } catch (regex_error&) {
+                throw file_error("invalid pattern");
+            }
+        }
+        string needle = literal ? pattern : required_literal(pattern);
+        for (const auto& file: start->find_files(whole_tokens(needle))) {
+            string text = file.second->get_plain_file_access()->str();
+            if (literal) {
+                print_matches(file.first, text, needle, [&] (const string& line, size_t at) {
+                    return line.find(needle, at) != string::npos;
+                });
+            } else {
+                print_matches(file.first, text, needle, [&] (const string& line, size_t) {
+                    return regex_search(line, expression);
+                });
+            }
+        }
+        cout.flush();
+    } catch(file_error& error){
+        cout << "grep: " << error.what() << endl;
+    }
+}
+
+void fn_load (inode_state& state, const wordvec& words){
+    try{
+        if (words.size() != 2) {
+            throw file_error("Missing file operand");
+        }
+        state.load(words[1]);
+    } catch(file_error& error){
+        cout << "load: " << words[1] << ": "<< error.what() << endl;
+    }
+}
+
+/**
+ * ls [-s] [PATH]. With -s, each line starts with the bytes under it.
+ */
 void fn_ls (inode_state& state, const wordvec& words){
+    bool totals = words.size() > 1 && words[1] == "-s";
+    wordvec args = words;
+    if (totals) {
+        args.erase(args.begin() + 1);
+    }
     try{
-        trace_path(state,words)->print_contents(false);
+        trace_path(state,args)->print_contents(false, totals);
     } catch(file_error& error){
-        cout << "ls: " << words[1] << ": "<< error.what() << endl;
+        cout << "ls: " << (args.size() > 1 ? args[1] + ": " : "") << error.what() << endl;
     }
 }
 
@@ -124,7 +420,7 @@ void fn_lsr (inode_state& state, const wordvec& words){
     try{
         trace_path(state,words)->print_contents(true);
     } catch(file_error& error){
-        cout << "lsr: " << words[1] << ": "<< error.what() << endl;
+        cout << "lsr: " << (words.size() > 1 ? words[1] + ": " : "") << error.what() << endl;
     }
 }
 
@@ -133,45 +429,94 @@ void fn_make (inode_state& state, const wordvec& words){
         if ( words.size() < 2) {
             throw file_error("Missing file operand");
         }
-        wordvec paths = split (words[1], "/");
-        string parent_path_string = get_parent_path(paths, words[1].front() == '/');
-        wordvec parent_path = words;
-        parent_path[1] = parent_path_string;
-        string content = "";
-        bool check = false;
-        for (int i = 2; i < words.size(); i++) {
+        size_t length = 0;
+        for (size_t i = 2; i < words.size(); i++) {
+            length += words[i].size() + 1;
+        }
+        string content;
+        content.reserve(max<size_t>(length, 1));
+        for (size_t i = 2; i < words.size(); i++) {
             content.append(words[i]);
             content.append(" ");
-            check = true;
         }
-        if (!check) {
+        if (content.empty()) {
             content = " ";
         }
-        trace_path(state, parent_path)->get_directory_access()->mkfile(paths.back(), content);
+        string name;
+        inode_ptr parent = resolve_parent(state, words[1], name);
+        parent->get_directory_access()->mkfile(name, content, parent);
     } catch (file_error& error) {
         cout << "make: " << error.what() << endl;
     }
 }
 
+void fn_mem (inode_state&, const wordvec&){
+    reclaimer::finish();
+    cout << "inodes: " << mem_stats::get_inodes() << endl;
+    cout << "bytes: " << mem_stats::get_bytes() << endl;
+    cout << "blob bytes: " << blob_store::get_physical() << endl;
+    cout << "names: " << name_table::size() << endl;
+    cout << "name bytes: " << name_table::get_bytes() << endl;
+}
+
 void fn_mkdir (inode_state& state, const wordvec& words){
     try {
         if (words.size() < 2) {
             throw file_error("Missing file operand");
         }
-        
-        wordvec paths = split (words[1], "/");
-        string parent_path_string = get_parent_path(paths, words[1].front() == '/');
-        wordvec parent_path = words;
-        parent_path[1] = parent_path_string;
-        inode_ptr parent = trace_path(state, parent_path);
-        parent->get_directory_access()->mkdir(paths.back(), parent);
-        
-        
+        string name;
+        inode_ptr parent = resolve_parent(state, words[1], name);
+        parent->get_directory_access()->mkdir(name, parent);
     } catch (file_error& error) {
         cout << "mkdir: " << error.what() << endl;
     }
 }
 
+/**
+ * mv SRC DST renames SRC to DST, or moves it into DST if that is a
+ * directory. A file replaces a file already at DST. Nothing is
+ * copied: the inode is relinked, whatever is below it.
+ */
+void fn_mv (inode_state& state, const wordvec& words){
+    try {
+        if (words.size() != 3) {
+            throw file_error("Missing file operand");
+        }
+        const string& source_path = words[1];
+        const string& target_path = words[2];
+        inode_ptr source = resolve_path(state, source_path);
+        if (source->get_parent() == nullptr) {
+            throw file_error("Invalid argument");
+        }
+        inode_ptr target = nullptr;
+        try {
+            target = resolve_path(state, target_path);
+        } catch (file_error&) {
+            // Not there yet: move to that name.
+        }
+        if (target == nullptr) {
+            string name;
+            inode_ptr parent = resolve_parent(state, target_path, name);
+            parent->get_directory_access()->relink(name, source, parent);
+        } else if (target->get_this_type() == file_type::DIRECTORY_TYPE) {
+            target->get_directory_access()->relink(source->get_name(), source, target);
+        } else if (source->get_this_type() == file_type::PLAIN_TYPE) {
+            if (target == source) {
+                return;
+            }
+            inode_ptr parent = target->get_parent();
+            string name = target->get_name();
+            directory_ptr dir = parent->get_directory_access();
+            dir->remove(name, false);
+            dir->relink(name, source, parent);
+        } else {
+            throw file_error(target_path + ": Not a directory");
+        }
+    } catch (file_error& error) {
+        cout << "mv: " << error.what() << endl;
+    }
+}
+
 void fn_prompt (inode_state& state, const wordvec& words){
     string new_prompt = "";
     for (int i = 1; i < words.size() ; i++) {
@@ -184,23 +529,22 @@ void fn_prompt (inode_state& state, const wordvec& words){
 }
 
 void fn_pwd (inode_state& state, const wordvec& words){
-    wordvec message_set;
-    string message = "";
-    inode_ptr temp = state.get_cwd();
-    if (temp == state.get_root()) {
-        message.append("/");
-        cout << message << endl;
-        return;
-    }
-    while (temp->get_name() != "/") {
-        message_set.push_back(temp->get_name());
-        temp = temp->get_directory_access()->get_inode_in_dirents("..");
+    try {
+        cout << state.get_cwd()->get_full_path() << endl;
+    } catch (file_error& error) {
+        cout << "pwd: " << error.what() << endl;
     }
-    for (int i = (int)message_set.size() -1 ; i >= 0;  i--) {
-        message.append("/");
-        message.append(message_set.at(i));
+}
+
+void fn_restore (inode_state& state, const wordvec& words){
+    try{
+        if (words.size() != 2) {
+            throw file_error("Missing snapshot name");
+        }
+        state.restore(words[1]);
+    } catch (file_error& error){
+        cout << "restore: " << error.what() << endl;
     }
-    cout << message << endl;
 }
 
 void fn_rm (inode_state& state, const wordvec& words){
@@ -211,11 +555,8 @@ void fn_rm (inode_state& state, const wordvec& words){
         if (words[1] == "/" || words[1] == "." || words[1] == "..") {
             throw file_error("Invalid argument");
         }
-        wordvec paths = split (words[1], "/");
-        string parent_path_string = get_parent_path(paths, words[1].front() == '/');
-        wordvec parent_path = words;
-        parent_path[1] = parent_path_string;
-        trace_path(state, parent_path)->get_directory_access()->remove(paths.back(), false);
+        string name;
+        resolve_parent(state, words[1], name)->get_directory_access()->remove(name, false);
     } catch (file_error& error){
         cout << "rm: " << error.what() << endl;
     }
@@ -229,16 +570,293 @@ void fn_rmr (inode_state& state, const wordvec& words){
         if (words[1] == "/" || words[1] == "." || words[1] == "..") {
             throw file_error("Invalid argument");
         }
-        wordvec paths = split (words[1], "/");
-        string parent_path_string = get_parent_path(paths, words[1].front() == '/');
-        wordvec parent_path = words;
-        parent_path[1] = parent_path_string;
-        trace_path(state, parent_path)->get_directory_access()->remove(paths.back(), true);
+        string name;
+        resolve_parent(state, words[1], name)->get_directory_access()->remove(name, true);
     } catch (file_error& error){
         cout << "rm: " << error.what() << endl;
     }
 }
 
+/**
+ * Appends a line to a file, creating it if it does not exist.
+ */
+static void append_text (inode_state& state, const string& filename, const string& text){
+    if (filename.find_first_not_of('/') == string::npos) {
+        throw file_error("Is a directory");
+    }
+    string name;
+    inode_ptr parent = resolve_parent(state, filename, name);
+    directory_ptr dir = parent->get_directory_access();
+    inode_ptr file = dir->check_filename(name) ?
+                     parent->lookup(name) :
+                     dir->mkfile(name, "", parent);
+    file->make_writable();
+    size_t old_size = file->get_size();
+    file->get_plain_file_access()->append_line(text);
+    file->resized(old_size);
+}
+
+/**
+ * The paths a glob operand names, in name order. A component with *,
+ * ? or [...] in it is matched against the dirents of each directory
+ * reached so far, looking only at the run of names that start with
+ * its literal prefix; a leading dot must be matched explicitly. Plain
+ * components are taken as they are, and checked once at the end.
+ */
+static wordvec expand_glob (inode_state& state, const string& pattern){
+    wordvec components = split (pattern, "/");
+    bool dirs_only = !pattern.empty() && pattern.back() == '/';
+    wordvec paths {!pattern.empty() && pattern.front() == '/' ? "/" : ""};
+    auto join = [] (const string& path, const string& name) {
+        return path.empty() ? name : path.back() == '/' ? path + name : path + "/" + name;
+    };
+    size_t literal_tail = 0;
+    for (size_t i = 0; i < components.size(); ++i) {
+        const string& component = components[i];
+        if (!is_glob(component)) {
+            for (auto& path: paths) {
+                path = join(path, component);
+            }
+            ++literal_tail;
+            continue;
+        }
+        literal_tail = 0;
+        bool leaf = i + 1 == components.size() && !dirs_only;
+        string prefix = component.substr(0, component.find_first_of("*?["));
+        wordvec matched;
+        for (const auto& path: paths) {
+            inode_ptr dir;
+            try {
+                dir = resolve_path(state, path);
+            } catch (file_error&) {
+                continue;
+            }
+            if (dir->get_this_type() != file_type::DIRECTORY_TYPE) {
+                continue;
+            }
+            dirent_view entries = dir->get_directory_access()->get_dirents();
+            for (const auto& entry: entries.starting_with(prefix)) {
+                const string& name = entry.name.str();
+                if ((name.front() != '.' || component.front() == '.')
+                    && (leaf || entry.node->get_this_type() == file_type::DIRECTORY_TYPE)
+                    && glob_match(component, name)) {
+                    matched.push_back(join(path, name));
+                }
+            }
+        }
+        paths = move(matched);
+    }
+    if (literal_tail > 0) {
+        auto missing = [&] (const string& path) {
+            try {
+                resolve_path(state, path);
+                return false;
+            } catch (file_error&) {
+                return true;
+            }
+        };
+        paths.erase(remove_if(paths.begin(), paths.end(), missing), paths.end());
+    }
+    return paths;
+}
+
+/**
+ * The word a command takes as the path operand that a glob may stand
+ * for, or words.size() if there is none. Most commands take it a
+ * fixed number of words from the end; grep takes it after PATTERN.
+ * find and the rest take no paths, or patterns of their own.
+ */
+static size_t glob_operand (const wordvec& words){
+    static const unordered_map<string,size_t> operand_from_end {
+        {"cat", 1}, {"cp", 2}, {"du", 1}, {"ls", 1}, {"lsr", 1}, {"mv", 2}, {"rm", 1}, {"rmr", 1},
+    };
+    if (words[0] == "grep") {
+        string pattern;
+        size_t next;
+        if (words.size() < 2 || !grep_pattern(words, pattern, next)) {
+            return words.size();
+        }
+        return next;
+    }
+    auto found = operand_from_end.find(words[0]);
+    if (found == operand_from_end.end() || words.size() <= found->second) {
+        return words.size();
+    }
+    return words.size() - found->second;
+}
+
+/**
+ * Runs a command once for each path its glob operand names, so
+ * "rm logs/x*" is one command line.
+ */
+static void run_expanded (command_fn fn, inode_state& state, const wordvec& words){
+    size_t operand = glob_operand(words);
+    if (operand >= words.size() || !is_glob(words[operand])) {
+        fn (state, words);
+        return;
+    }
+    wordvec paths = expand_glob(state, words[operand]);
+    if (paths.empty()) {
+        cout << words[0] << ": " << words[operand] << ": No match" << endl;
+        return;
+    }
+    wordvec expanded = words;
+    for (const auto& path: paths) {
+        expanded[operand] = path;
+        fn (state, expanded);
+    }
+}
+
+/**
+ * Runs a command with its output appended to a file, as for
+ * "command ... >> file". The file is created if it does not exist.
+ */
+void run_appending (command_fn fn, inode_state& state, const wordvec& words,
+                    const string& filename){
+    ostringstream output;
+    streambuf* saved = cout.rdbuf(output.rdbuf());
+    try {
+        run_expanded (fn, state, words);
+    } catch (...) {
+        cout.rdbuf(saved);
+        throw;
+    }
+    cout.rdbuf(saved);
+    string text = output.str();
+    if (!text.empty() && text.back() == '\n') {
+        text.pop_back();
+    }
+    try {
+        if (journal::enabled()) {
+            journal::record(journal::APPEND, wordvec {absolute_path(state, filename), text});
+        }
+        append_text(state, filename, text);
+    } catch (file_error& error){
+        cout << ">>: " << filename << ": " << error.what() << endl;
+    }
+}
+
+/**
+ * A path as seen from the root, so journal records do not depend on
+ * the directory they were typed in.
+ */
+string absolute_path (inode_state& state, const string& path){
+    if (!path.empty() && path.front() == '/') {
+        return path;
+    }
+    string cwd = state.get_cwd()->get_full_path();
+    return cwd == "/" ? cwd + path : cwd + "/" + path;
+}
+
+/**
+ * Logs a command that changes the tree. Paths are made absolute;
+ * commands that change nothing are not logged. A relative path in a
+ * removed cwd has no absolute form, so such a command is refused
+ * rather than logged wrong.
+ */
+static void journal_command (inode_state& state, const wordvec& words){
+    static const unordered_set<string> changes_tree {
+        "cp", "load", "make", "mkdir", "mv", "restore", "rm", "rmr", "snapshot",
+    };
+    if (changes_tree.count(words[0]) == 0 || words.size() < 2) {
+        return;
+    }
+    wordvec logged = words;
+    try {
+        if (words[0] == "cp" || words[0] == "mv") {
+            for (size_t i = 1; i < logged.size(); ++i) {
+                if (logged[i] != "-r") {
+                    logged[i] = absolute_path(state, logged[i]);
+                }
+            }
+        } else if (words[0] != "load" && words[0] != "restore" && words[0] != "snapshot") {
+            logged[1] = absolute_path(state, logged[1]);
+        }
+    } catch (file_error& error) {
+        throw command_error(words[0] + ": " + error.what());
+    }
+    journal::record(journal::COMMAND, logged);
+}
+
+/**
+ * Runs one command line, already split into words, handling a
+ * trailing ">> file" and logging it to the journal if there is one.
+ * A glob is logged as typed; replaying it expands it again, against
+ * the same tree.
+ */
+void execute (inode_state& state, wordvec& words){
+    // The reclaimer frees in between commands, never during one.
+    lock_guard<mutex> guard (reclaimer::tree_lock());
+    // "command ... >> file" appends the output to file.
+    string append_to;
+    if (words.size() >= 3 && words[words.size() - 2] == ">>") {
+        append_to = words.back();
+        words.resize(words.size() - 2);
+    }
+    command_fn fn = find_command_fn (words.at(0));
+    if (journal::enabled()) {
+        journal_command(state, words);
+    }
+    if (append_to.empty()) {
+        run_expanded (fn, state, words);
+    } else {
+        run_appending (fn, state, words, append_to);
+    }
+    if (journal::compaction_due()) {
+        try {
+            journal::compact(state);
+        } catch (file_error& error) {
+            complain() << "journal: " << error.what() << endl;
+        }
+    }
+}
+
+/**
+ * Applies one journal record during replay.
+ */
+void replay_record (inode_state& state, journal::record_kind kind, const wordvec& words){
+    if (kind == journal::APPEND && words.size() == 2) {
+        append_text(state, words[0], words[1]);
+    } else if (kind == journal::COMMAND && !words.empty()) {
+        run_expanded (find_command_fn(words[0]), state, words);
+    }
+}
+
+void fn_save (inode_state& state, const wordvec& words){
+    try{
+        if (words.size() != 2) {
+            throw file_error("Missing file operand");
+        }
+        state.save(words[1]);
+    } catch(file_error& error){
+        cout << "save: " << words[1] << ": "<< error.what() << endl;
+    }
+}
+
+/**
+ * snapshot NAME remembers the tree; with no name, lists snapshots.
+ */
+void fn_snapshot (inode_state& state, const wordvec& words){
+    if (words.size() == 1) {
+        for (const auto& snapshot: state.get_snapshots()) {
+            cout << snapshot.first << endl;
+        }
+    } else {
+        state.snapshot(words[1]);
+    }
+}
+
+/**
+ * sync commits the journal and writes out any output held back by a
+ * batch run.
+ */
+void fn_sync (inode_state&, const wordvec&){
+    journal::commit();
+    cout.flush();
+    block_output* held = dynamic_cast<block_output*> (cout.rdbuf());
+    if (held != nullptr) held->write_out();
+}
+
 void fn_com (inode_state& state, const wordvec& words){
     // Does nothing
 }
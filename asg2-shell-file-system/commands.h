@@ -7,6 +7,7 @@
 using namespace std;
 
 #include "file_sys.h"
+#include "journal.h"
 #include "util.h"
 
 // A couple of convenient usings to avoid verbosity.
@@ -27,21 +28,55 @@ class command_error: public runtime_error {
 
 void fn_cat    (inode_state& state, const wordvec& words);
 void fn_cd     (inode_state& state, const wordvec& words);
+void fn_cp     (inode_state& state, const wordvec& words);
+void fn_df     (inode_state& state, const wordvec& words);
+void fn_du     (inode_state& state, const wordvec& words);
 void fn_echo   (inode_state& state, const wordvec& words);
 void fn_exit   (inode_state& state, const wordvec& words);
+void fn_find   (inode_state& state, const wordvec& words);
+void fn_grep   (inode_state& state, const wordvec& words);
+void fn_load   (inode_state& state, const wordvec& words);
 void fn_ls     (inode_state& state, const wordvec& words);
 void fn_lsr    (inode_state& state, const wordvec& words);
 void fn_make   (inode_state& state, const wordvec& words);
+void fn_mem    (inode_state& state, const wordvec& words);
 void fn_mkdir  (inode_state& state, const wordvec& words);
+void fn_mv     (inode_state& state, const wordvec& words);
 void fn_prompt (inode_state& state, const wordvec& words);
 void fn_pwd    (inode_state& state, const wordvec& words);
+void fn_restore(inode_state& state, const wordvec& words);
 void fn_rm     (inode_state& state, const wordvec& words);
 void fn_rmr    (inode_state& state, const wordvec& words);
+void fn_save   (inode_state& state, const wordvec& words);
+void fn_snapshot(inode_state& state, const wordvec& words);
+void fn_sync   (inode_state& state, const wordvec& words);
 void fn_com    (inode_state& state, const wordvec& words);
 
 
 command_fn find_command_fn (const string& command);
 
+// run_appending -
+//    Runs a command with cout captured, then appends what it printed
+//    to a file, for "command ... >> file".
+
+void run_appending (command_fn fn, inode_state& state, const wordvec& words,
+                    const string& filename);
+
+// execute -
+//    Runs one command line, with ">> file" handled, a glob in a path
+//    operand expanded, and the command logged to the journal if it
+//    changes the tree. Takes the words by reference, and drops the
+//    ">> file" from them.
+// replay_record -
+//    Applies a journal record; the journal's replay callback.
+// absolute_path -
+//    A path relative to the cwd, made relative to the root.
+
+void execute (inode_state& state, wordvec& words);
+void replay_record (inode_state& state, journal::record_kind kind,
+                    const wordvec& words);
+string absolute_path (inode_state& state, const string& path);
+
 // exit_status_message -
 //    Prints an exit message and returns the exit status, as recorded
 //    by any of the functions.
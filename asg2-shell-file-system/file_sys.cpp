@@ -1,5 +1,6 @@
 // $Id: file_sys.cpp,v 1.5 2016-01-14 16:16:52-08 - - $
 
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <unordered_map>
@@ -8,8 +9,33 @@ using namespace std;
 
 #include "debug.h"
 #include "file_sys.h"
+#include "image.h"
+#include "pool.h"
 
 int inode::next_inode_nr {1};
+unsigned long inode::path_generation {1};
+vector<inode*> inode::by_number {nullptr};
+unsigned long inode::copy_epoch {1};
+priority_queue<pair<size_t,int>> inode::unsettled;
+size_t mem_stats::inodes {0};
+size_t mem_stats::bytes {0};
+size_t mem_stats::data {0};
+// Defined before dentry_cache::table, so destroyed after it.
+unordered_map<string,size_t> name_table::names;
+size_t name_table::bytes {0};
+unordered_map<const name_table::entry*,unordered_set<int>> name_index::inodes;
+unordered_set<int> name_index::unindexed;
+const size_t content_index::batch_size {256};
+unordered_map<string,unordered_set<int>> content_index::postings;
+unordered_map<int,vector<const string*>> content_index::indexed;
+unordered_set<int> content_index::pending;
+unordered_map<string,size_t> blob_store::blobs;
+size_t blob_store::logical {0};
+size_t blob_store::physical {0};
+unordered_map<int,dentry_cache::dentry_map> dentry_cache::table;
+size_t dentry_cache::entries {0};
+const size_t dentry_cache::max_entries {1 << 20};
+unordered_map<int,copy_views::view_map> copy_views::table;
 
 /* FILE_TYPE */
 struct file_type_hash {
@@ -22,155 +48,1349 @@ file_error::file_error (const string& what): runtime_error (what) {
 }
 
 
+/* NAME_TABLE */
+name_table::entry* name_table::acquire (const string& name) {
+    entry* found = &*names.emplace(name, 0).first;
+    if (found->second == 0) {
+        bytes += sizeof(entry) + name.size();
+    }
+    ++found->second;
+    return found;
+}
+
+name_table::entry* name_table::find (const string& name) {
+    auto found = names.find(name);
+    return found == names.end() ? nullptr : &*found;
+}
+
+void name_table::release (entry* name) {
+    if (--name->second == 0) {
+        bytes -= sizeof(entry) + name->first.size();
+        names.erase(name->first);
+    }
+}
+
+const string& interned_name::str() const {
+    static const string empty {};
+    return text == nullptr ? empty : text->first;
+}
+
+
+/* BLOB_STORE */
+blob_store::entry* blob_store::acquire (const string& content) {
+    entry* found = &*blobs.emplace(content, 0).first;
+    if (found->second == 0) {
+        physical += content.size();
+    }
+    share(found);
+    return found;
+}
+
+void blob_store::share (entry* blob) {
+    ++blob->second;
+    logical += blob->first.size();
+}
+
+void blob_store::release (entry* blob) {
+    logical -= blob->first.size();
+    if (--blob->second == 0) {
+        physical -= blob->first.size();
+        blobs.erase(blob->first);
+    }
+}
+
+
+/* DIRENT_TABLE */
+const uint32_t dirent_table::EMPTY;
+const uint32_t dirent_table::REMOVED;
+const size_t dirent_table::MIN_SLOTS;
+
+/**
+ * Probes for a name.
+ *
+ * @return the slot holding it (found = true), or else the slot where
+ *         it should go (found = false)
+ */
+size_t dirent_table::locate (const string& name, bool& found) const {
+    size_t mask = slots.size() - 1;
+    size_t slot = hash<string>()(name) & mask;
+    size_t reuse = slots.size();
+    for (;;) {
+        uint32_t index = slots[slot];
+        if (index == EMPTY) {
+            found = false;
+            return reuse < slots.size() ? reuse : slot;
+        }
+        if (index == REMOVED) {
+            if (reuse == slots.size()) {
+                reuse = slot;
+            }
+        } else if (entries[index].name.str() == name) {
+            found = true;
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+void dirent_table::rehash (size_t capacity) const {
+    slots.assign(capacity, EMPTY);
+    const_cast<dirent_table*>(this)->removed = 0;
+    bool found;
+    for (size_t index = 0; index < entries.size(); ++index) {
+        slots[locate(entries[index].name.str(), found)] = index;
+    }
+}
+
+dirent* dirent_table::find (const string& name) {
+    if (entries.empty()) {
+        return nullptr;
+    }
+    bool found;
+    size_t slot = locate(name, found);
+    return found ? &entries[slots[slot]] : nullptr;
+}
+
+void dirent_table::insert (const string& name, const inode_ptr& node) {
+    if ((entries.size() + removed + 1) * 2 > slots.size()) {
+        size_t capacity = MIN_SLOTS;
+        while (capacity < (entries.size() + 1) * 4) {
+            capacity *= 2;
+        }
+        rehash(capacity);
+    }
+    bool found;
+    size_t slot = locate(name, found);
+    if (slots[slot] == REMOVED) {
+        --removed;
+    }
+    if (!entries.empty() && name < entries.back().name.str()) {
+        sorted = false;
+    }
+    slots[slot] = entries.size();
+    entries.push_back(dirent {interned_name(name), node});
+}
+
+void dirent_table::erase (const string& name) {
+    if (entries.empty()) {
+        return;
+    }
+    bool found;
+    size_t slot = locate(name, found);
+    if (!found) {
+        return;
+    }
+    uint32_t index = slots[slot];
+    slots[slot] = REMOVED;
+    ++removed;
+    if (index + 1 != entries.size()) {
+        // Re-point the last entry's slot while its name is still there.
+        slots[locate(entries.back().name.str(), found)] = index;
+        entries[index] = move(entries.back());
+        sorted = false;
+    }
+    entries.pop_back();
+}
+
+void dirent_table::drain (vector<inode_ptr>& nodes) {
+    for (auto& entry: entries) {
+        nodes.push_back(move(entry.node));
+    }
+    clear();
+}
+
+void dirent_table::clear() {
+    entries.clear();
+    slots.clear();
+    removed = 0;
+    sorted = true;
+}
+
+dirent_view dirent_view::starting_with (const string& prefix) const {
+    auto from = lower_bound(first, last, prefix,
+                            [](const dirent& entry, const string& key) {
+                                return entry.name.str() < key;
+                            });
+    auto to = partition_point(from, last, [&](const dirent& entry) {
+                                  return entry.name.str().compare(0, prefix.size(), prefix) == 0;
+                              });
+    return dirent_view(from, to);
+}
+
+dirent_view dirent_table::view() const {
+    if (!sorted) {
+        sort(entries.begin(), entries.end(),
+             [](const dirent& left, const dirent& right) {
+                 return left.name.str() < right.name.str();
+             });
+        rehash(slots.size());
+        sorted = true;
+    }
+    return dirent_view(entries);
+}
+
+
+/* DENTRY_CACHE */
+bool dentry_cache::lookup (int dir_nr, const string& name, inode_ptr& result) {
+    auto dir = table.find(dir_nr);
+    if (dir == table.end()) {
+        return false;
+    }
+    // A name nobody has interned cannot have a cache entry.
+    const name_table::entry* key = name_table::find(name);
+    if (key == nullptr) {
+        return false;
+    }
+    auto found = dir->second.find(key);
+    if (found == dir->second.end()) {
+        return false;
+    }
+    if (found->second.target_nr == 0) {
+        result = nullptr;
+        return true;
+    }
+    result = inode::find(found->second.target_nr);
+    return result != nullptr;
+}
+
+void dentry_cache::insert (int dir_nr, const string& name, const inode_ptr& target) {
+    // Crude bound on memory: start over rather than track recency.
+    if (entries >= max_entries) {
+        table.clear();
+        entries = 0;
+    }
+    interned_name key {name};
+    dentry& entry = table[dir_nr][key.get()];
+    if (entry.name.get() == nullptr) {
+        ++entries;
+    }
+    entry.name = key;
+    entry.target_nr = target == nullptr ? 0 : target->get_inode_nr();
+}
+
+void dentry_cache::invalidate (int dir_nr, const string& name) {
+    auto dir = table.find(dir_nr);
+    const name_table::entry* key = name_table::find(name);
+    if (dir != table.end() && key != nullptr) {
+        entries -= dir->second.erase(key);
+    }
+}
+
+void dentry_cache::forget (int dir_nr) {
+    auto dir = table.find(dir_nr);
+    if (dir != table.end()) {
+        entries -= dir->second.size();
+        table.erase(dir);
+    }
+}
+
+
+/* COPY_VIEWS */
+inode_ptr copy_views::find (int dir_nr, const string& name) {
+    auto dir = table.find(dir_nr);
+    const name_table::entry* key = name_table::find(name);
+    if (dir == table.end() || key == nullptr) {
+        return nullptr;
+    }
+    auto found = dir->second.find(key);
+    return found == dir->second.end() ? nullptr : found->second;
+}
+
+void copy_views::add (int dir_nr, const string& name, const inode_ptr& view) {
+    table[dir_nr][name_table::find(name)] = view;
+}
+
+void copy_views::forget (int dir_nr) {
+    auto dir = table.find(dir_nr);
+    if (dir != table.end()) {
+        // Freeing a directory view forgets its own views in turn.
+        view_map views = move(dir->second);
+        table.erase(dir);
+    }
+}
+
+
+/* NAME_INDEX */
+void name_index::add (const interned_name& name, int inode_nr) {
+    inodes[name.get()].insert(inode_nr);
+}
+
+void name_index::remove (const interned_name& name, int inode_nr) {
+    auto found = inodes.find(name.get());
+    if (found != inodes.end()) {
+        found->second.erase(inode_nr);
+        if (found->second.empty()) {
+            inodes.erase(found);
+        }
+    }
+    unindexed.erase(inode_nr);
+}
+
+// A directory the index could not see into still cannot.
+void name_index::rename (const interned_name& from, const interned_name& to, int inode_nr) {
+    bool hidden = unindexed.count(inode_nr) != 0;
+    remove(from, inode_nr);
+    add(to, inode_nr);
+    if (hidden) {
+        unindexed.insert(inode_nr);
+    }
+}
+
+/**
+ * A plain name is one hash probe; a glob is tried against each
+ * distinct name in use, not each inode.
+ */
+vector<int> name_index::match (const string& pattern) {
+    vector<int> result;
+    if (!is_glob(pattern)) {
+        const name_table::entry* name = name_table::find(pattern);
+        auto found = name == nullptr ? inodes.end() : inodes.find(name);
+        if (found != inodes.end()) {
+            result.assign(found->second.begin(), found->second.end());
+        }
+        return result;
+    }
+    for (const auto& name: inodes) {
+        if (glob_match(pattern, name.first->first)) {
+            result.insert(result.end(), name.second.begin(), name.second.end());
+        }
+    }
+    return result;
+}
+
+
+/* CONTENT_INDEX */
+/**
+ * Wakes the reclaimer once a batch is pending rather than on every
+ * change, so a run of makes is indexed together.
+ */
+void content_index::changed (int inode_nr) {
+    pending.insert(inode_nr);
+    if (pending.size() == batch_size) {
+        reclaimer::nudge();
+    }
+}
+
+void content_index::unindex (int inode_nr) {
+    auto found = indexed.find(inode_nr);
+    if (found == indexed.end()) {
+        return;
+    }
+    for (const string* token: found->second) {
+        auto posting = postings.find(*token);
+        posting->second.erase(inode_nr);
+        if (posting->second.empty()) {
+            postings.erase(posting);
+        }
+    }
+    indexed.erase(found);
+}
+
+void content_index::update (size_t budget) {
+    while (!pending.empty() && budget-- > 0) {
+        int inode_nr = *pending.begin();
+        pending.erase(pending.begin());
+        unindex(inode_nr);
+        inode_ptr file = inode::find(inode_nr);
+        if (file == nullptr || file->get_this_type() != file_type::PLAIN_TYPE) {
+            continue;
+        }
+        vector<const string*>& tokens = indexed[inode_nr];
+        for (const auto& token: tokenize(file->get_plain_file_access()->str())) {
+            auto posting = postings.emplace(token, unordered_set<int> {}).first;
+            posting->second.insert(inode_nr);
+            tokens.push_back(&posting->first);
+        }
+    }
+}
+
+/**
+ * Intersects the posting sets, starting from the smallest.
+ */
+unordered_set<int> content_index::lookup (const wordvec& tokens) {
+    update(pending.size());
+    vector<const unordered_set<int>*> sets;
+    for (const auto& token: tokens) {
+        auto posting = postings.find(token);
+        if (posting == postings.end()) {
+            return {};
+        }
+        sets.push_back(&posting->second);
+    }
+    auto smaller = [] (const unordered_set<int>* a, const unordered_set<int>* b) {
+        return a->size() < b->size();
+    };
+    sort(sets.begin(), sets.end(), smaller);
+    unordered_set<int> result;
+    for (int inode_nr: *sets.front()) {
+        bool everywhere = true;
+        for (size_t i = 1; i < sets.size() && everywhere; ++i) {
+            everywhere = sets[i]->count(inode_nr) > 0;
+        }
+        if (everywhere) {
+            result.insert(inode_nr);
+        }
+    }
+    return result;
+}
+
+wordvec content_index::tokenize (const string& text) {
+    wordvec tokens;
+    unordered_set<string> seen;
+    size_t end = 0;
+    for (;;) {
+        size_t begin = end;
+        while (begin < text.size() && !is_word_char(text[begin])) {
+            ++begin;
+        }
+        if (begin == text.size()) {
+            break;
+        }
+        end = begin;
+        while (end < text.size() && is_word_char(text[end])) {
+            ++end;
+        }
+        string token = text.substr(begin, end - begin);
+        if (seen.insert(token).second) {
+            tokens.push_back(move(token));
+        }
+    }
+    return tokens;
+}
+
+
 /* INODE_STATE */
 inode_state::inode_state() {
-    root = make_shared<inode>(file_type::DIRECTORY_TYPE);
-    root->get_directory_access()->set_name("/");
-    root->get_directory_access()->insert_dirent(".", root);
-    root->get_directory_access()->insert_dirent("..", root);
+    root = inode::create(file_type::DIRECTORY_TYPE, "/", nullptr);
+    cwd = root;
+}
+
+void inode_state::save (const string& filename) {
+    image::save(root, filename);
+}
+
+/**
+ * Replaces the live tree with the one in an image. Only the root is
+ * read now; the rest is loaded as it is reached.
+ */
+void inode_state::load (const string& filename) {
+    shared_ptr<image> source = image::open(filename);
+    inode_ptr top = inode::create(file_type::DIRECTORY_TYPE, "/", nullptr);
+    top->get_directory_access()->back_with(source, source->root());
+    root = top;
+    cwd = root;
+    inode::invalidate_paths();
+}
+
+/**
+ * Remembers the tree as it is now. The copy shares everything with
+ * the live tree until one of them changes.
+ */
+void inode_state::snapshot (const string& name) {
+    snapshots[name] = root->clone(nullptr, "/");
+}
+
+/**
+ * Replaces the live tree with a copy of a snapshot, so the snapshot
+ * itself stays as it was.
+ */
+void inode_state::restore (const string& name) {
+    auto found = snapshots.find(name);
+    if (found == snapshots.end()) {
+        throw file_error("No such snapshot");
+    }
+    root = found->second->clone(nullptr, "/");
+    cwd = root;
+    inode::invalidate_paths();
+}
+
+/**
+ * Saves the tree and the snapshots together, for the journal. The
+ * image holds a top directory with tree/, snapshots/NAME and a
+ * generation file.
+ */
+void inode_state::checkpoint (const string& filename, uint64_t generation) {
+    inode_ptr top = inode::create(file_type::DIRECTORY_TYPE, "/", nullptr);
+    directory_ptr dir = top->get_directory_access();
+    dir->mkcopy("tree", root, top);
+    inode_ptr saved = dir->mkdir("snapshots", top);
+    for (const auto& snapshot: snapshots) {
+        saved->get_directory_access()->mkcopy(snapshot.first, snapshot.second, saved);
+    }
+    dir->mkfile("generation", to_string(generation) + " ", top);
+    image::save(top, filename);
+}
+
+/**
+ * Loads a checkpoint written by checkpoint() and returns its
+ * generation. As with load(), directories are read as they are reached.
+ */
+uint64_t inode_state::recover (const string& filename) {
+    shared_ptr<image> source = image::open(filename);
+    inode_ptr top = inode::create(file_type::DIRECTORY_TYPE, "/", nullptr);
+    top->get_directory_access()->back_with(source, source->root());
+    wordvec generation = top->lookup("generation")->get_plain_file_access()->readfile();
+    if (generation.empty()) {
+        throw file_error("Corrupt image");
+    }
+    inode_ptr saved = top->lookup("snapshots");
+    snapshots.clear();
+    wordvec names;
+    for (const auto& entry: saved->get_directory_access()->get_dirents()) {
+        names.push_back(entry.name.str());
+    }
+    for (const auto& name: names) {
+        snapshots[name] = saved->lookup(name)->clone(nullptr, "/");
+    }
+    root = top->lookup("tree")->clone(nullptr, "/");
     cwd = root;
+    inode::invalidate_paths();
+    return stoull(generation[0]);
 }
 
 /* INODE */
-inode::inode (file_type type):
+inode::inode (file_type type, const string& name, inode_ptr parent):
 inode_nr (next_inode_nr++),
-this_type(type){
+depth (parent == nullptr ? 0 : parent->depth + 1),
+this_type(type),
+parented(parent != nullptr),
+parent(parent),
+name(name){
     switch (this_type) {
         case file_type::DIRECTORY_TYPE:
-            contents =  make_shared<directory>();
+            new (&dir) directory(inode_nr);
             break;
         case file_type::PLAIN_TYPE:
-            contents = make_shared<plain_file>();
+            new (&file) plain_file(inode_nr);
             break;
     }
+    by_number.push_back(this);
+    name_index::add(this->name, inode_nr);
+    mem_stats::add_inode(sizeof(inode));
 }
 
-size_t inode::get_size(){
+inode::~inode() {
+    by_number[inode_nr] = nullptr;
+    name_index::remove(name, inode_nr);
     switch (this_type) {
         case file_type::DIRECTORY_TYPE:
-            return dynamic_pointer_cast<directory> (contents)->directory::size();
+            dir.~directory();
             break;
         case file_type::PLAIN_TYPE:
-            return dynamic_pointer_cast<plain_file> (contents)->plain_file::size();
+            file.~plain_file();
             break;
     }
+    mem_stats::remove_inode(sizeof(inode));
 }
-string inode::get_name(){
+
+inode_ptr inode::create (file_type type, const string& name, inode_ptr parent) {
+    return allocate_shared<inode>(slab_allocator<inode>(), type, name, parent);
+}
+
+inode_ptr inode::find (int inode_nr) {
+    if (inode_nr <= 0 || static_cast<size_t>(inode_nr) >= by_number.size() ||
+        by_number[inode_nr] == nullptr) {
+        return nullptr;
+    }
+    return by_number[inode_nr]->shared_from_this();
+}
+
+/**
+ * A file counts its size and itself. A directory's totals are exact as
+ * of the last settle_totals(), or now if nothing below it is queued.
+ */
+subtree_totals inode::get_totals() {
+    if (this_type == file_type::PLAIN_TYPE) {
+        return subtree_totals {file.size(), 1};
+    }
+    return dir.totals;
+}
+
+void inode::resized (size_t old_size) {
+    inode_ptr up = get_parent();
+    if (up != nullptr) {
+        up->dir.totals.bytes += file.size() - old_size;
+        up->mark_unsettled();
+    }
+}
+
+void inode::mark_unsettled() {
+    if (!dir.unsettled) {
+        dir.unsettled = true;
+        unsettled.push(make_pair(depth, inode_nr));
+    }
+}
+
+/**
+ * Adds each queued directory's unreported change into its parent,
+ * deepest first, so a parent queued by several children is carried
+ * up once. A directory no longer linked under its parent (removed,
+ * but still the cwd) reports to no one.
+ */
+void inode::settle_totals() {
+    while (!unsettled.empty()) {
+        int inode_nr = unsettled.top().second;
+        unsettled.pop();
+        inode* node = by_number[inode_nr];
+        if (node == nullptr) {
+            continue;
+        }
+        directory& dir = node->dir;
+        dir.unsettled = false;
+        subtree_totals change {dir.totals.bytes - dir.reported.bytes,
+                               dir.totals.inodes - dir.reported.inodes};
+        dir.reported = dir.totals;
+        inode_ptr up = node->get_parent();
+        if (up == nullptr || up->dir.backing != nullptr) {
+            continue;
+        }
+        dirent* linked = up->dir.dirents->find(node->name.str());
+        if (linked == nullptr || linked->node.get() != node) {
+            continue;
+        }
+        up->dir.totals.bytes += change.bytes;
+        up->dir.totals.inodes += change.inodes;
+        up->mark_unsettled();
+    }
+}
+
+/**
+ * Appends one component to an absolute path.
+ */
+static string join_path (const string& path, const string& name) {
+    return path == "/" ? path + name : path + "/" + name;
+}
+
+/**
+ * Whether the parent pointers lead from here up to the given
+ * directory, through dirents that really hold each inode on the way.
+ * An inode in a snapshot, or removed but still the cwd, does not.
+ */
+bool inode::reaches (const inode* ancestor) {
+    inode_ptr node = shared_from_this();
+    while (node.get() != ancestor) {
+        inode_ptr up = node->get_parent();
+        if (up == nullptr || up->dir.backing != nullptr) {
+            return false;
+        }
+        dirent* linked = up->dir.dirents->find(node->name.str());
+        if (linked == nullptr || linked->node != node) {
+            return false;
+        }
+        node = up;
+    }
+    return true;
+}
+
+/**
+ * The number listings show for this inode. A copy_views stand-in is
+ * in no table until something below it is written, so until then it
+ * shows the number of the entry it stands for, as the walk in lsr,
+ * which goes through the tables, finds it.
+ */
+int inode::listed_nr() {
+    inode_ptr up = get_parent();
+    if (up == nullptr || copy_views::find(up->inode_nr, name.str()).get() != this) {
+        return inode_nr;
+    }
+    return up->dir.dirents->find(name.str())->node->inode_nr;
+}
+
+/**
+ * Whether the name_index cannot see this directory's entries: it is
+ * not loaded yet, or its dirents are parented elsewhere. A table is
+ * only written once unshared, so any one entry speaks for all.
+ */
+bool inode::is_unindexed() {
+    if (this_type != file_type::DIRECTORY_TYPE) {
+        return false;
+    }
+    if (dir.backing != nullptr) {
+        return true;
+    }
+    if (dir.dirents->size() == 0) {
+        return false;
+    }
+    return dir.dirents->any().node->get_parent().get() != this;
+}
+
+/**
+ * Visits everything below this directory, depth first, with its path.
+ */
+void inode::walk (const visitor& visit) {
+    vector<pair<inode_ptr,string>> stack {{shared_from_this(), get_full_path()}};
+    while (!stack.empty()) {
+        inode_ptr node = move(stack.back().first);
+        string path = move(stack.back().second);
+        stack.pop_back();
+        for (const auto& entry: node->dir.get_dirents()) {
+            string child = join_path(path, entry.name.str());
+            visit(child, entry.node);
+            if (entry.node->get_this_type() == file_type::DIRECTORY_TYPE) {
+                stack.emplace_back(entry.node, child);
+            }
+        }
+    }
+}
+
+/**
+ * Walks the directories below this one that the name_index cannot see
+ * into, pruning the ones it can now. Walking loads directories, which
+ * changes the set; whatever a walk loads is indexed once it returns.
+ */
+void inode::walk_unindexed (const visitor& visit) {
+    unordered_set<int>& unindexed = name_index::get_unindexed();
+    vector<int> hidden (unindexed.begin(), unindexed.end());
+    for (int inode_nr: hidden) {
+        inode* node = by_number[inode_nr];
+        if (node == nullptr || !node->is_unindexed()) {
+            unindexed.erase(inode_nr);
+        } else if (node != this && node->reaches(this)) {
+            node->walk(visit);
+        }
+    }
+}
+
+/**
+ * find: the name_index gives the inodes with matching names, and each
+ * is kept if it really lies below this directory. Directories the
+ * index cannot see into are walked. Paths come out sorted.
+ */
+vector<string> inode::find_names (const string& pattern) {
+    if (this_type == file_type::PLAIN_TYPE) {
+        throw file_error("Is a file.");
+    }
+    vector<string> paths;
+    auto matching = [&] (const string& path, const inode_ptr& node) {
+        if (glob_match(pattern, node->name.str())) {
+            paths.push_back(path);
+        }
+    };
+    if (is_unindexed()) {
+        if (glob_match(pattern, name.str())) {
+            paths.push_back(get_full_path());
+        }
+        walk(matching);
+    } else {
+        walk_unindexed(matching);
+        for (int inode_nr: name_index::match(pattern)) {
+            inode* node = by_number[inode_nr];
+            if (node != nullptr && node->reaches(this)) {
+                paths.push_back(node->get_full_path());
+            }
+        }
+    }
+    sort(paths.begin(), paths.end());
+    paths.erase(unique(paths.begin(), paths.end()), paths.end());
+    return paths;
+}
+
+/**
+ * grep: the files at or below this inode that contain every one of
+ * the tokens, or all of them if there are none, sorted by path. The
+ * content_index narrows them down; files in directories the
+ * name_index cannot see into are found by walking and then checked
+ * against the same posting sets.
+ */
+vector<pair<string,inode_ptr>> inode::find_files (const wordvec& tokens) {
+    vector<pair<string,inode_ptr>> files;
+    if (this_type == file_type::PLAIN_TYPE) {
+        files.emplace_back(get_full_path(), shared_from_this());
+        return files;
+    }
+    auto plain = [&] (const string& path, const inode_ptr& node) {
+        if (node->this_type == file_type::PLAIN_TYPE) {
+            files.emplace_back(path, node);
+        }
+    };
+    bool hidden = is_unindexed();
+    if (tokens.empty() || hidden) {
+        walk(plain);
+    } else {
+        walk_unindexed(plain);
+    }
+    if (!tokens.empty()) {
+        unordered_set<int> found = content_index::lookup(tokens);
+        auto unlisted = [&] (const pair<string,inode_ptr>& file) {
+            return found.count(file.second->inode_nr) == 0;
+        };
+        files.erase(remove_if(files.begin(), files.end(), unlisted), files.end());
+        if (!hidden) {
+            for (int inode_nr: found) {
+                inode* node = by_number[inode_nr];
+                if (node != nullptr && node->reaches(this)) {
+                    files.emplace_back(node->get_full_path(), node->shared_from_this());
+                }
+            }
+        }
+    }
+    sort(files.begin(), files.end(),
+         [] (const pair<string,inode_ptr>& a, const pair<string,inode_ptr>& b) {
+             return a.first < b.first;
+         });
+    auto same = [] (const pair<string,inode_ptr>& a, const pair<string,inode_ptr>& b) {
+        return a.first == b.first;
+    };
+    files.erase(unique(files.begin(), files.end(), same), files.end());
+    return files;
+}
+
+size_t inode::get_size(){
     switch (this_type) {
         case file_type::DIRECTORY_TYPE:
-            return this->get_directory_access()->get_name();
+            return dir.size();
             break;
         case file_type::PLAIN_TYPE:
-            return this->get_plain_file_access()->get_name();
+            return file.size();
             break;
     }
 }
+string inode::get_name(){
+    return name.str();
+}
 
+/**
+ * Whether this inode had a parent that has since been freed, as when
+ * the cwd's ancestors are removed. The root never had one.
+ */
+bool inode::lost_parent() const {
+    return parented && parent.expired();
+}
 
+/**
+ * Builds the path by following parent pointers up to the root, or to
+ * the nearest ancestor whose memoized path is still valid, and
+ * memoizes the result for this inode.
+ */
 string inode::get_full_path(){
-    if (this->get_name() == "/") {
-        return "/";
+    if (full_path_generation == path_generation) {
+        return full_path;
     }
-    string parent_path = "";
-    wordvec reverse_build {};
-    reverse_build.push_back(this->get_name());
-    inode_ptr temp = this->get_directory_access()->get_inode_in_dirents("..");
-    while (temp->get_name() != "/"){
-        reverse_build.push_back(temp->get_name());
-        temp = temp->get_directory_access()->get_inode_in_dirents("..");
+    vector<inode_ptr> ancestors;
+    string path = "/";
+    for (inode_ptr node = shared_from_this();;) {
+        if (node->unlinked) {
+            throw file_error("Directory was removed");
+        }
+        inode_ptr up = node->get_parent();
+        if (up == nullptr) {
+            if (node->lost_parent()) {
+                throw file_error("Directory was removed");
+            }
+            break;
+        }
+        if (up->full_path_generation == path_generation) {
+            path = up->full_path;
+            break;
+        }
+        ancestors.push_back(up);
+        node = up;
     }
-    for (auto it = reverse_build.rbegin(); it != reverse_build.rend(); it++) {
-        parent_path.append("/");
-        parent_path.append(it->data());
+    for (auto it = ancestors.rbegin(); it != ancestors.rend(); it++) {
+        if ((*it)->get_parent() != nullptr) {
+            path = join_path(path, (*it)->get_name());
+        }
     }
-    return parent_path;
+    full_path = get_parent() == nullptr ? "/" : join_path(path, get_name());
+    full_path_generation = path_generation;
+    return full_path;
 }
 
 
-shared_ptr<directory> inode::get_directory_access() {
+/**
+ * A new inode, under a new parent and name, with the same contents.
+ * A directory shares its dirent table; a file shares its blobs.
+ */
+inode_ptr inode::clone (inode_ptr parent, const string& name) {
+    inode_ptr copy = create(this_type, name, parent);
+    if (this_type == file_type::DIRECTORY_TYPE && dir.backing != nullptr) {
+        copy->dir.back_with(dir.backing, dir.backing_offset);
+    } else if (this_type == file_type::DIRECTORY_TYPE) {
+        // The copy shares children that would settle into this inode.
+        settle_totals();
+        copy->dir.dirents = dir.dirents;
+        copy->dir.totals = copy->dir.reported = dir.totals;
+        name_index::add_unindexed(copy->inode_nr);
+        ++copy_epoch;
+    } else {
+        copy->file.copy_from(file);
+    }
+    return copy;
+}
+
+/**
+ * Unshares each directory above this inode, from the top of its tree
+ * down, if any directory has been copied since it was last written.
+ * Each one takes its own dirent table, holding the next inode on the
+ * way, so afterwards nothing reachable from a copy leads here.
+ */
+void inode::make_writable() {
+    if (write_epoch == copy_epoch) {
+        return;
+    }
+    vector<inode*> path {this};
+    for (inode_ptr up = get_parent(); up != nullptr; up = up->get_parent()) {
+        path.push_back(up.get());
+    }
+    for (size_t i = path.size() - 1; i > 0; --i) {
+        path[i]->dir.unshare();
+        path[i]->write_epoch = copy_epoch;
+    }
+    write_epoch = copy_epoch;
+}
+
+/**
+ * Finds the inode named in this directory. Consults the dentry_cache
+ * first and records the outcome, positive or negative, on a miss.
+ * Nothing is unshared: a child still parented elsewhere comes back as
+ * its copy_views stand-in, which make_writable() puts in place.
+ */
+inode_ptr inode::lookup (const string& name) {
     if (this_type == file_type::PLAIN_TYPE) {
         throw file_error("Is a file.");
     }
-    shared_ptr<directory> dir_ptr = dynamic_pointer_cast<directory> (contents);
-    if (dir_ptr == nullptr) {
-        throw file_error("cast_directory fail: dir nullptr");
+    if (name == ".") {
+        return shared_from_this();
     }
-    return dir_ptr;
+    if (name == "..") {
+        inode_ptr up = get_parent();
+        if (unlinked || lost_parent()) {
+            throw file_error ("Directory was removed");
+        }
+        return up == nullptr ? shared_from_this() : up;
+    }
+    dir.load();
+    inode_ptr result;
+    if (!dentry_cache::lookup(inode_nr, name, result)) {
+        dirent* found = dir.dirents->find(name);
+        if (found != nullptr) {
+            result = found->node;
+        }
+        // Still the original's child, from a copy: stand in for it.
+        if (result != nullptr && result->get_parent().get() != this) {
+            result = copy_views::find(inode_nr, name);
+            if (result == nullptr) {
+                result = found->node->clone(shared_from_this(), name);
+                result->write_epoch = 0;
+                copy_views::add(inode_nr, name, result);
+            }
+        }
+        dentry_cache::insert(inode_nr, name, result);
+    }
+    if (result == nullptr) {
+        throw file_error ("No such file or directory");
+    }
+    return result;
+}
+
+/**
+ * The contents share ownership with this inode, so the pointers
+ * returned here keep the whole inode alive.
+ */
+shared_ptr<directory> inode::get_directory_access() {
+    if (this_type == file_type::PLAIN_TYPE) {
+        throw file_error("Is a file.");
+    }
+    return shared_ptr<directory>(shared_from_this(), &dir);
 }
 
 shared_ptr<plain_file> inode::get_plain_file_access() {
     if (this_type == file_type::DIRECTORY_TYPE) {
         throw file_error("Is a directory.");
     }
-    shared_ptr<plain_file> file_ptr = dynamic_pointer_cast<plain_file> (contents);
-    if (file_ptr == nullptr) {
-        throw file_error("cast_directory fail: direnullptr");
-    }
-    return file_ptr;
+    return shared_ptr<plain_file>(shared_from_this(), &file);
 }
 
-void inode::print_contents(bool recursive){
-    cout << this->get_full_path() << ":" << endl;
+void inode::print_contents(bool recursive, bool totals){
     if (this_type == file_type::PLAIN_TYPE) {
-        cout << this->get_name() << endl;
-    } else {
-        map<string,inode_ptr> dirents = this->get_directory_access()->get_dirents();
-        for (auto it = dirents.cbegin(); it != dirents.cend(); it++) {
-            cout << this->inode_nr << "\t" << it->second->get_size();
-            if (it->first == "." || it->first == "..") {
-                cout << "\t" << it->first << endl;
-            } else if (it->second->get_this_type() == file_type::DIRECTORY_TYPE){
-                cout << "\t" << it->first << "/" << endl;
-            } else {
-                cout << "\t" << it->first << endl;
+        throw file_error("Is a file.");
+    }
+    inode_ptr up = get_parent();
+    size_t parent_size = up == nullptr ? get_size() : up->get_size();
+    string path = get_full_path();
+    buffered_writer out (cout);
+    if (totals) {
+        settle_totals();
+        subtree_totals parent_totals = up == nullptr ? get_totals() : up->get_totals();
+        print_listing(out, path, parent_size, &parent_totals);
+        return;
+    }
+    if (recursive && work_pool::enabled()) {
+        print_parallel(out, path, parent_size);
+        return;
+    }
+    print_listing(out, path, parent_size);
+    if (!recursive) {
+        return;
+    }
+    // Depth first, with a frame per open directory instead of a call,
+    // so depth is bounded by memory rather than by the C++ stack. The
+    // path is one string, extended on the way down and cut back on
+    // the way up.
+    struct frame {
+        inode_ptr dir;
+        dirent_vec::const_iterator next;
+        dirent_vec::const_iterator end;
+        size_t path_length;
+    };
+    vector<frame> stack;
+    dirent_view top = dir.get_dirents();
+    stack.push_back(frame {shared_from_this(), top.begin(), top.end(), path.size()});
+    while (!stack.empty()) {
+        frame& current = stack.back();
+        while (current.next != current.end &&
+               current.next->node->get_this_type() != file_type::DIRECTORY_TYPE) {
+            ++current.next;
+        }
+        if (current.next == current.end) {
+            stack.pop_back();
+            continue;
+        }
+        const dirent& entry = *current.next++;
+        path.resize(current.path_length);
+        if (path != "/") {
+            path += '/';
+        }
+        path += entry.name.str();
+        inode_ptr child = entry.node;
+        child->print_listing(out, path, current.dir->get_size());
+        dirent_view entries = child->dir.get_dirents();
+        stack.push_back(frame {child, entries.begin(), entries.end(), path.size()});
+    }
+}
+
+/**
+ * One directory of a parallel lsr: listed by whichever thread claims
+ * it first, then written out by the main thread in tree order.
+ */
+struct inode::listing {
+    static const size_t unwritten_limit = 1 << 26;
+    static atomic<size_t> unwritten;
+    enum {QUEUED, RUNNING, DONE};
+    inode_ptr dir;
+    string path;
+    size_t parent_size;
+    atomic<int> state {QUEUED};
+    string text;
+    vector<shared_ptr<listing>> children;
+    listing (inode_ptr dir, const string& path, size_t parent_size):
+    dir(dir), path(path), parent_size(parent_size) {};
+};
+const size_t inode::listing::unwritten_limit;
+atomic<size_t> inode::listing::unwritten {0};
+
+/**
+ * Lists one directory into its own buffer, then queues its
+ * subdirectories.
+ */
+void inode::run_listing (const shared_ptr<listing>& task) {
+    int expected = listing::QUEUED;
+    if (!task->state.compare_exchange_strong(expected, listing::RUNNING)) {
+        return;
+    }
+    inode_ptr node = move(task->dir);
+    buffered_writer out;
+    node->print_listing(out, task->path, task->parent_size);
+    size_t size = node->get_size();
+    for (const auto& entry: node->dir.get_dirents()) {
+        if (entry.node->get_this_type() == file_type::DIRECTORY_TYPE) {
+            string path = task->path == "/" ? "/" + entry.name.str() :
+                          task->path + "/" + entry.name.str();
+            task->children.push_back(make_shared<listing>(entry.node, path, size));
+        }
+    }
+    task->text = move(out.str());
+    listing::unwritten += task->text.size();
+    task->state = listing::DONE;
+    for (auto child = task->children.rbegin(); child != task->children.rend(); ++child) {
+        shared_ptr<listing> next = *child;
+        work_pool::submit([next] {
+            // Hold back while the main thread is far behind.
+            while (listing::unwritten > listing::unwritten_limit &&
+                   next->state == listing::QUEUED) {
+                this_thread::yield();
+            }
+            run_listing(next);
+        });
+    }
+}
+
+/**
+ * lsr on the work_pool. Any thread may list any directory, but only
+ * the main thread writes, in the same order as the serial walk: it
+ * takes the next listing in order, and lists it itself if no one has
+ * started it, or else waits for the thread that has.
+ */
+void inode::print_parallel (buffered_writer& out, const string& path, size_t parent_size) {
+    // Loading from an image allocates, and numbers inodes in the order
+    // it happens, so everything below is loaded here first, in the
+    // order the serial walk would load it. The tasks then only read.
+    vector<inode_ptr> unloaded {shared_from_this()};
+    while (!unloaded.empty()) {
+        inode_ptr node = move(unloaded.back());
+        unloaded.pop_back();
+        dirent_view entries = node->dir.get_dirents();
+        for (auto entry = entries.end(); entry != entries.begin(); ) {
+            --entry;
+            if (entry->node->get_this_type() == file_type::DIRECTORY_TYPE) {
+                unloaded.push_back(entry->node);
             }
         }
     }
-    if (recursive) {
-        map<string,inode_ptr> dirents = this->get_directory_access()->get_dirents();
-        for (auto it = dirents.cbegin(); it != dirents.cend(); it++) {
-            if ( it->second->get_this_type() == file_type::DIRECTORY_TYPE) {
-                if (it->first != "." && it->first != "..") {
-                    it->second->print_contents(true);
-                }
+    vector<shared_ptr<listing>> stack;
+    stack.push_back(make_shared<listing>(shared_from_this(), path, parent_size));
+    while (!stack.empty()) {
+        shared_ptr<listing> task = move(stack.back());
+        stack.pop_back();
+        run_listing(task);
+        while (task->state != listing::DONE) {
+            this_thread::yield();
+        }
+        out << task->text;
+        listing::unwritten -= task->text.size();
+        string().swap(task->text);
+        stack.insert(stack.end(), task->children.rbegin(), task->children.rend());
+    }
+    // Claimed tasks are left queued; clear them out before the tree changes.
+    work_pool::wait();
+}
+
+/**
+ * Lists this directory under the given path. Subdirectory paths, and
+ * the size shown for (..), are passed in by print_contents(), so lsr
+ * never walks back up; an entry still shared with a copy may not name
+ * this directory as its parent.
+ * (.) and (..) are not stored, so they are merged in where they sort.
+ * Given the parent's totals, each line starts with its subtree bytes.
+ */
+void inode::print_listing(buffered_writer& out, const string& path, size_t parent_size,
+                          const subtree_totals* parent_totals){
+    int number = listed_nr();
+    out << path << ":\n";
+    const string dots[] {".", ".."};
+    const size_t dot_sizes[] {get_size(), parent_size};
+    const size_t dot_totals[] {dir.totals.bytes, parent_totals ? parent_totals->bytes : 0};
+    size_t next_dot = 0;
+    auto print_dots_before = [&](const string* name) {
+        for (; next_dot < 2 && (name == nullptr || dots[next_dot] < *name); ++next_dot) {
+            if (parent_totals != nullptr) {
+                out << dot_totals[next_dot] << '\t';
             }
+            out << number << '\t' << dot_sizes[next_dot]
+                << '\t' << dots[next_dot] << '\n';
         }
+    };
+    for (const auto& entry: dir.get_dirents()) {
+        const string& name = entry.name.str();
+        print_dots_before(&name);
+        if (parent_totals != nullptr) {
+            out << entry.node->get_totals().bytes << '\t';
+        }
+        out << number << '\t' << entry.node->get_size() << '\t' << name;
+        if (entry.node->get_this_type() == file_type::DIRECTORY_TYPE){
+            out << '/';
+        }
+        out << '\n';
     }
-    
+    print_dots_before(nullptr);
 }
 
 
 /* DIRECTORY */
+/**
+ * Frees the subtree below this directory. Children owned by nothing
+ * else are emptied onto a work list before they are destroyed, so a
+ * deep tree is not freed by one recursive destructor call per level.
+ */
+directory::~directory() {
+    dentry_cache::forget(inode_nr);
+    copy_views::forget(inode_nr);
+    if (dirents.use_count() != 1) {
+        return;
+    }
+    vector<inode_ptr> doomed;
+    dirents->drain(doomed);
+    release(doomed, SIZE_MAX);
+}
 
-void directory::remove (const string& filename, bool recursive) {
-    if(!check_filename(filename)){
-        throw file_error("No such file or directory");
+/**
+ * Frees up to budget inodes from a work list, pushing the children of
+ * each directory that nothing else owns onto the list first.
+ */
+void directory::release (vector<inode_ptr>& doomed, size_t budget) {
+    for (size_t freed = 0; freed < budget && !doomed.empty(); ++freed) {
+        inode_ptr node = move(doomed.back());
+        doomed.pop_back();
+        if (node.use_count() == 1 && node->get_this_type() == file_type::DIRECTORY_TYPE) {
+            shared_ptr<dirent_table>& table = node->get_directory_access()->dirents;
+            if (table.use_count() == 1) {
+                table->drain(doomed);
+            }
+        }
     }
-    inode_ptr toDelete = this->dirents.at(filename);
-    if (toDelete->get_this_type() == file_type::PLAIN_TYPE) {
-        this->dirents.erase(filename);
+}
+
+/**
+ * Gives this directory its own copy of a shared dirent table. The
+ * children parented here stay with this directory; the table left to
+ * the other sharers gets parentless clones of them instead, which
+ * those directories adopt() in turn. Children parented elsewhere are
+ * cloned into the new table now, or replaced by the stand-in lookup()
+ * already handed out for them, so no inode is left in two tables where
+ * a change through one would show through the other. Either way, each
+ * child's contents end up shared one level down.
+ */
+void directory::unshare() {
+    load();
+    if (dirents.use_count() == 1) {
+        adopt();
         return;
     }
-    unsigned long check = toDelete->get_directory_access()->dirents.size();
-    if (check == 2) {
-        toDelete->get_directory_access()->dirents.clear();
-        this->dirents.erase(this->dirents.find(filename));
-    } else if (!recursive) {
-        throw file_error("Directory is not empty");
-    }
-    
-    if (recursive) {
-        for (auto it = toDelete->get_directory_access()->dirents.cbegin(); it != toDelete->get_directory_access()->dirents.cend(); it++) {
-            if (it->first != "." && it->first != "..") {
-                if (it->second->get_this_type() == file_type::PLAIN_TYPE) {
-                    toDelete->get_directory_access()->dirents.erase(it->first);
-                } else {
-                    toDelete->get_directory_access()->remove(it->first, true);
-                }
-            }
+    shared_ptr<dirent_table> own = make_shared<dirent_table>(*dirents);
+    inode_ptr owner = inode::find(inode_nr);
+    for (auto& entry: own->entries) {
+        if (entry.node->get_parent() != owner) {
+            inode_ptr view = copy_views::find(inode_nr, entry.name.str());
+            entry.node = view != nullptr ? view : entry.node->clone(owner, entry.name.str());
+        }
+    }
+    for (auto& entry: dirents->entries) {
+        if (entry.node->get_parent() == owner) {
+            entry.node = entry.node->clone(nullptr, entry.name.str());
         }
-        toDelete->get_directory_access()->dirents.clear();
-        this->dirents.erase(this->dirents.find(filename));
+    }
+    dirents = own;
+    copy_views::forget(inode_nr);
+}
+
+/**
+ * The last holder of a table that was shared. Whoever else held it
+ * either went away or unshared, leaving clones parented nowhere, and
+ * those are this directory's now, unless lookup() handed out a
+ * stand-in for one. Until then no entry was written, so any one entry
+ * tells whether there is anything to do.
+ */
+void directory::adopt() {
+    if (dirents->size() == 0) {
+        return;
+    }
+    inode_ptr owner = inode::find(inode_nr);
+    if (dirents->any().node->get_parent() == owner) {
+        return;
+    }
+    for (auto& entry: dirents->entries) {
+        inode_ptr up = entry.node->get_parent();
+        inode_ptr view = copy_views::find(inode_nr, entry.name.str());
+        if (view != nullptr) {
+            entry.node = view;
+        } else if (up == nullptr) {
+            entry.node->parent = owner;
+            entry.node->parented = true;
+        } else if (up != owner) {
+            entry.node = entry.node->clone(owner, entry.name.str());
+        }
+    }
+    copy_views::forget(inode_nr);
+    inode::invalidate_paths();
+}
+
+// (.) and (..) are implicit, but still counted.
+size_t directory::size() const {
+    if (backing != nullptr) {
+        return backing->directory_size(backing_offset) + 2;
+    }
+    return dirents->size() + 2;
+}
+
+void directory::back_with (const shared_ptr<image>& source, uint64_t offset) {
+    dirents = make_shared<dirent_table>();
+    backing = source;
+    backing_offset = offset;
+    totals = reported = source->directory_totals(offset);
+    name_index::add_unindexed(inode_nr);
+}
+
+/**
+ * Counts a new entry into this directory's totals. Its own totals are
+ * now reported, so later changes below it go through the queue.
+ */
+void directory::child_added (const inode_ptr& child) {
+    totals.bytes += child->get_totals().bytes;
+    totals.inodes += child->get_totals().inodes;
+    if (child->get_this_type() == file_type::DIRECTORY_TYPE) {
+        child->dir.reported = child->dir.totals;
+    }
+    inode::find(inode_nr)->mark_unsettled();
+}
+
+/**
+ * Takes a removed entry out of the totals: as much of it as was ever
+ * reported here.
+ */
+void directory::child_removed (const inode_ptr& child) {
+    subtree_totals gone = child->get_this_type() == file_type::DIRECTORY_TYPE ?
+                          child->dir.reported : child->get_totals();
+    totals.bytes -= gone.bytes;
+    totals.inodes -= gone.inodes;
+    inode::find(inode_nr)->mark_unsettled();
+}
+
+/**
+ * Reads this directory's entries from its image record. Files get
+ * their contents now; subdirectories are left to load in turn.
+ */
+void directory::materialize() {
+    vector<image::entry> entries = backing->read_directory(backing_offset);
+    shared_ptr<image> source = move(backing);
+    backing = nullptr;
+    inode_ptr owner = inode::find(inode_nr);
+    for (const auto& entry: entries) {
+        inode_ptr child = inode::create(entry.type, entry.name, owner);
+        if (entry.type == file_type::DIRECTORY_TYPE) {
+            child->get_directory_access()->back_with(source, entry.offset);
+        } else {
+            child->get_plain_file_access()->writefile(wordvec {source->read_file(entry.offset)});
+        }
+        dirents->insert(entry.name, child);
+    }
+}
+
+void directory::insert_dirent(const string& name, inode_ptr toInsert){
+    inode::find(inode_nr)->make_writable();
+    unshare();
+    dirents->insert(name, toInsert);
+    child_added(toInsert);
+    dentry_cache::invalidate(inode_nr, name);
+}
+
+/**
+ * Unlinks a dirent. The inode, and everything below it, is freed as
+ * soon as the last pointer to it goes away.
+ */
+void directory::remove (const string& filename, bool recursive) {
+    if (filename == "." || filename == "..") {
+        throw file_error("Invalid argument");
+    }
+    inode::find(inode_nr)->make_writable();
+    unshare();
+    dirent* found = dirents->find(filename);
+    if(found == nullptr){
+        throw file_error("No such file or directory");
+    }
+    inode_ptr toDelete = found->node;
+    if (toDelete->get_this_type() == file_type::DIRECTORY_TYPE) {
+        unsigned long check = toDelete->get_directory_access()->size();
+        if (check != 2 && !recursive) {
+            throw file_error("Directory is not empty");
+        }
+    }
+    dirents->erase(filename);
+    toDelete->unlinked = true;
+    child_removed(toDelete);
+    dentry_cache::invalidate(inode_nr, filename);
+    inode::invalidate_paths();
+    if (recursive && reclaimer::enabled()) {
+        reclaimer::submit(move(toDelete));
     }
 }
 
@@ -184,40 +1404,199 @@ inode_ptr directory::mkdir (const string& dirname, inode_ptr parent) {
     if(check_filename(dirname)){
         throw file_error ("File exists");
     }
-    inode_ptr dir = make_shared<inode>(file_type::DIRECTORY_TYPE);
-    dir->get_directory_access()->set_name(dirname);
-    dir->get_directory_access()->dirents.insert(std::pair<string, inode_ptr>(".", dir));
-    dir->get_directory_access()->dirents.insert(std::pair<string, inode_ptr>("..", parent));
-    this->dirents.insert(std::pair<string, inode_ptr>(dirname, dir));
+    inode_ptr dir = inode::create(file_type::DIRECTORY_TYPE, dirname, parent);
+    insert_dirent(dirname, dir);
     return nullptr;
 }
 
-inode_ptr directory::mkfile (const string& filename, const string& contents) {
+/**
+ * This method makes a file under the caller's dirents.
+ *
+ * @return the new file
+ */
+inode_ptr directory::mkfile (const string& filename, const string& contents, inode_ptr parent) {
     if(check_filename(filename)){
         throw file_error ("File exists");
     }
-    inode_ptr file = make_shared<inode>(file_type::PLAIN_TYPE);
-    wordvec data {};
-    data.push_back(filename);
-    data.push_back(contents);
-    file->get_plain_file_access()->writefile(data);
-    this->dirents.insert(std::pair<string, inode_ptr>(filename, file));
-    return nullptr;
+    inode_ptr file = inode::create(file_type::PLAIN_TYPE, filename, parent);
+    file->get_plain_file_access()->writefile(wordvec {contents});
+    insert_dirent(filename, file);
+    return file;
 }
 
-directory_ptr directory::get_dir_in_dirents (string dir_name){
-    if(!check_filename(dir_name)){
-        throw file_error ("No such file or directory");
+/**
+ * This method puts a copy of source under the caller's dirents. The
+ * copy costs O(1): a directory's contents are shared until one side
+ * changes them.
+ *
+ * @return the copy
+ */
+inode_ptr directory::mkcopy (const string& name, const inode_ptr& source, inode_ptr parent) {
+    if(check_filename(name)){
+        throw file_error ("File exists");
+    }
+    inode_ptr copy = source->clone(parent, name);
+    insert_dirent(name, copy);
+    return copy;
+}
+
+/**
+ * This method moves source from its parent's dirents into the
+ * caller's, under the given name. Only the two dirents, the name, and
+ * the parent pointer change, so a directory moves in O(1) whatever is
+ * below it. Its descendants keep their old depth: settle_totals() may
+ * then carry some change up in two steps rather than one, but never
+ * loses it.
+ */
+void directory::relink (const string& name, const inode_ptr& source, inode_ptr parent) {
+    if (name == "." || name == "..") {
+        throw file_error("Invalid argument");
+    }
+    inode_ptr from = source->get_parent();
+    if (from == nullptr) {
+        throw file_error("Invalid argument");
     }
-    return this->dirents.find(dir_name)->second->get_directory_access();
+    for (inode_ptr up = parent; up != nullptr; up = up->get_parent()) {
+        if (up == source) {
+            throw file_error("Invalid argument");
+        }
+    }
+    string old_name = source->get_name();
+    if (from == parent && old_name == name) {
+        return;
+    }
+    from->make_writable();
+    from->dir.unshare();
+    parent->make_writable();
+    unshare();
+    dirent* found = from->dir.dirents->find(old_name);
+    if (found == nullptr || found->node != source) {
+        throw file_error("No such file or directory");
+    }
+    if (check_filename(name)) {
+        throw file_error("File exists");
+    }
+    from->dir.dirents->erase(old_name);
+    from->dir.child_removed(source);
+    dentry_cache::invalidate(from->inode_nr, old_name);
+    interned_name new_name (name);
+    name_index::rename(source->name, new_name, source->inode_nr);
+    source->name = new_name;
+    source->parent = parent;
+    source->parented = true;
+    source->depth = parent->depth + 1;
+    insert_dirent(name, source);
+    inode::invalidate_paths();
+}
+
+directory_ptr directory::get_dir_in_dirents (string dir_name){
+    return get_inode_in_dirents(dir_name)->get_directory_access();
 }
 
 inode_ptr directory::get_inode_in_dirents(string dir_name){
-    if(!check_filename(dir_name)){
+    load();
+    dirent* found = dirents->find(dir_name);
+    if(found == nullptr){
         throw file_error ("No such file or directory");
     }
-    inode_ptr target = dirents.at(dir_name);
-    return target;
+    return found->node;
+}
+
+
+/* PLAIN_FILE */
+const size_t plain_file::chunk_size;
+
+// Only the tail is charged to mem_stats; blobs are counted by the blob_store.
+plain_file::~plain_file() {
+    mem_stats::remove_data(tail.size());
+    content_index::changed(inode_nr);
+}
+
+wordvec plain_file::readfile() const {
+    wordvec pieces;
+    for (const auto& chunk: chunks) {
+        pieces.push_back(chunk.str());
+    }
+    if (!tail.empty()) {
+        pieces.push_back(tail);
+    }
+    return pieces;
+}
+
+void plain_file::write_to (ostream& out) const {
+    for (const auto& chunk: chunks) {
+        out << chunk.str();
+    }
+    out << tail;
+}
+
+string plain_file::str() const {
+    string text;
+    text.reserve(bytes);
+    for (const auto& chunk: chunks) {
+        text += chunk.str();
+    }
+    text += tail;
+    return text;
+}
+
+void plain_file::copy_from (const plain_file& that) {
+    mem_stats::remove_data(tail.size());
+    chunks = that.chunks;
+    tail = that.tail;
+    bytes = that.bytes;
+    mem_stats::add_data(tail.size());
+    content_index::changed(inode_nr);
+}
+
+void plain_file::writefile (const wordvec& newdata) {
+    mem_stats::remove_data(tail.size());
+    chunks.clear();
+    tail.clear();
+    bytes = 0;
+    for (const auto& piece: newdata) {
+        append(piece);
+    }
+    seal();
+    content_index::changed(inode_nr);
+}
+
+/**
+ * Moves the tail into the blob_store.
+ */
+void plain_file::seal() {
+    if (!tail.empty()) {
+        mem_stats::remove_data(tail.size());
+        chunks.emplace_back(tail);
+        tail.clear();
+    }
+}
+
+void plain_file::append (const string& text) {
+    if (tail.size() + text.size() > chunk_size) {
+        seal();
+    }
+    tail += text;
+    bytes += text.size();
+    mem_stats::add_data(text.size());
+    if (tail.size() >= chunk_size) {
+        seal();
+    }
+}
+
+/**
+ * Adds text as a new line, ending with the same separator space make
+ * leaves. An empty file is replaced rather than appended to.
+ */
+void plain_file::append_line (const string& text) {
+    if (size() == 0) {
+        writefile(wordvec {});
+    } else {
+        append("\n");
+    }
+    append(text);
+    append(" ");
+    content_index::changed(inode_nr);
 }
 
 
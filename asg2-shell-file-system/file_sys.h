@@ -3,13 +3,19 @@
 #ifndef __INODE_H__
 #define __INODE_H__
 
+#include <cstdint>
 #include <exception>
+#include <functional>
 #include <iostream>
-#include <memory>
 #include <map>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 using namespace std;
 
+#include "slab.h"
 #include "util.h"
 
 /**
@@ -31,12 +37,12 @@ class file_error;
 class plain_file;
 class directory;
 class base_file;
+class image;
 
 /**
  *  Declaration of type alias.
  */
 using inode_ptr = shared_ptr<inode>;
-using base_file_ptr = shared_ptr<base_file>;
 using plain_file_ptr = shared_ptr<plain_file>;
 using directory_ptr = shared_ptr<directory>;
 
@@ -59,6 +65,343 @@ public:
     explicit file_error (const string& what);
 };
 
+/**
+ *  Class mem_stats
+ *  Static class. Running totals for the mem command: the number of live
+ *  inodes, the bytes held by them, and the file data not yet sealed
+ *  into the blob_store. Interned names and blobs are counted by their
+ *  own tables.
+ */
+class mem_stats {
+private:
+    static size_t inodes;
+    static size_t bytes;
+    static size_t data;
+public:
+    static void add_inode (size_t size) { ++inodes; bytes += size; };
+    static void remove_inode (size_t size) { --inodes; bytes -= size; };
+    static void add_data (size_t size) { data += size; };
+    static void remove_data (size_t size) { data -= size; };
+    static size_t get_inodes() { return inodes; };
+    static size_t get_bytes() { return bytes + data; };
+    static size_t get_data() { return data; };
+};
+
+/**
+ *  Struct subtree_totals
+ *  The bytes in the files under a directory, and the number of inodes
+ *  under it, itself included. See inode::get_totals().
+ */
+struct subtree_totals {
+    size_t bytes;
+    size_t inodes;
+};
+
+/**
+ *  Class name_table
+ *  Static class. Interns file names: each distinct name is stored once,
+ *  with a count of the interned_name handles that refer to it. The
+ *  entry is erased when the last handle goes away.
+ *
+ *  Methods:
+ *  acquire()   Returns the entry for a name, creating it if needed.
+ *  find()      Returns the entry for a name, or nullptr. Never creates.
+ *  release()   Drops one reference to an entry.
+ *  size()      Number of distinct names.
+ */
+class name_table {
+public:
+    using entry = pair<const string,size_t>;
+private:
+    static unordered_map<string,size_t> names;
+    static size_t bytes;
+public:
+    static entry* acquire (const string& name);
+    static entry* find (const string& name);
+    static void release (entry* name);
+    static size_t size() { return names.size(); };
+    static size_t get_bytes() { return bytes; };
+};
+
+/**
+ *  Class interned_name
+ *  A counted handle to a name in the name_table. Copying a handle only
+ *  bumps a count; moving it is free. Two handles are equal exactly when
+ *  they refer to the same entry.
+ */
+class interned_name {
+private:
+    name_table::entry* text {nullptr};
+public:
+    interned_name() = default;
+    explicit interned_name (const string& name): text(name_table::acquire(name)) {};
+    interned_name (const interned_name& that): text(that.text) { if (text != nullptr) ++text->second; };
+    interned_name (interned_name&& that) noexcept: text(that.text) { that.text = nullptr; };
+    interned_name& operator= (interned_name that) noexcept { swap(text, that.text); return *this; };
+    ~interned_name() { if (text != nullptr) name_table::release(text); };
+    const string& str() const;
+    const name_table::entry* get() const { return text; };
+    bool operator== (const interned_name& that) const { return text == that.text; };
+};
+
+/**
+ *  Class blob_store
+ *  Static class. Content-addressed storage for file bodies. Each
+ *  distinct chunk of content is stored once, keyed by the content
+ *  itself, with a count of the blob handles that refer to it. Blobs
+ *  are immutable; the entry is erased when the last handle goes away.
+ *
+ *  Logical bytes count every reference, physical bytes every distinct
+ *  blob once. The df command reports both.
+ *
+ *  Methods:
+ *  acquire()   Returns the entry for some content, creating it if needed.
+ *  share()     Adds one reference to an entry.
+ *  release()   Drops one reference to an entry.
+ */
+class blob_store {
+public:
+    using entry = pair<const string,size_t>;
+private:
+    static unordered_map<string,size_t> blobs;
+    static size_t logical;
+    static size_t physical;
+public:
+    static entry* acquire (const string& content);
+    static void share (entry* blob);
+    static void release (entry* blob);
+    static size_t size() { return blobs.size(); };
+    static size_t get_logical() { return logical; };
+    static size_t get_physical() { return physical; };
+};
+
+/**
+ *  Class blob
+ *  A counted handle to an immutable chunk of content in the blob_store.
+ *  Copying a blob shares the content; it is never duplicated.
+ */
+class blob {
+private:
+    blob_store::entry* content {nullptr};
+public:
+    blob() = default;
+    explicit blob (const string& text): content(blob_store::acquire(text)) {};
+    blob (const blob& that): content(that.content) { if (content != nullptr) blob_store::share(content); };
+    blob (blob&& that) noexcept: content(that.content) { that.content = nullptr; };
+    blob& operator= (blob that) noexcept { swap(content, that.content); return *this; };
+    ~blob() { if (content != nullptr) blob_store::release(content); };
+    const string& str() const { return content->first; };
+    size_t size() const { return content->first.size(); };
+};
+
+/**
+ *  Struct dirent
+ *  One entry of a directory: an interned name and the inode it names.
+ */
+struct dirent {
+    interned_name name;
+    inode_ptr node;
+};
+using dirent_vec = vector<dirent>;
+
+/**
+ *  Class dirent_view
+ *  A read-only range over a directory's dirents, in name order.
+ *  Nothing is copied; the view refers to the directory's own storage
+ *  and is invalidated by anything that adds or removes a dirent.
+ *
+ *  starting_with() narrows the view to the names with a prefix, by
+ *  binary search, since they sit together in name order.
+ *
+ *  Usage:
+ *  for (const auto& entry: dir->get_dirents()) { entry.name ... entry.node ... }
+ */
+class dirent_view {
+private:
+    dirent_vec::const_iterator first;
+    dirent_vec::const_iterator last;
+    dirent_view (dirent_vec::const_iterator first, dirent_vec::const_iterator last):
+    first(first), last(last) {};
+public:
+    dirent_view (const dirent_vec& dirents):
+    first(dirents.cbegin()), last(dirents.cend()) {};
+    dirent_view starting_with (const string& prefix) const;
+    dirent_vec::const_iterator begin() const { return first; };
+    dirent_vec::const_iterator end() const { return last; };
+    size_t size() const { return last - first; };
+};
+
+/**
+ *  Class dirent_table
+ *  Flat storage for a directory's dirents. The dirents themselves sit
+ *  in one vector; an open-addressing index of 32-bit positions into
+ *  that vector (linear probing, at most half full) finds a name with
+ *  one hash and a probe or two, all in contiguous memory.
+ *
+ *  Insertion appends and removal moves the last dirent into the hole,
+ *  so both are O(1). Name order is restored lazily: view() sorts the
+ *  vector and rebuilds the index only if something arrived out of
+ *  order since the last view.
+ *
+ *  Methods:
+ *  find()      The dirent with this name, or nullptr.
+ *  insert()    Add a dirent. The caller checks the name is not present.
+ *  erase()     Remove the dirent with this name, if any.
+ *  view()      A dirent_view in name order.
+ *  any()       Some dirent, without sorting. The table must not be empty.
+ *  drain()     Move every inode out, leaving the table empty.
+ */
+class dirent_table {
+    friend class directory;
+private:
+    static const uint32_t EMPTY = UINT32_MAX;
+    static const uint32_t REMOVED = UINT32_MAX - 1;
+    static const size_t MIN_SLOTS = 8;
+    mutable dirent_vec entries;
+    mutable vector<uint32_t> slots;
+    mutable bool sorted {true};
+    size_t removed {0};
+    size_t locate (const string& name, bool& found) const;
+    void rehash (size_t capacity) const;
+public:
+    dirent* find (const string& name);
+    void insert (const string& name, const inode_ptr& node);
+    void erase (const string& name);
+    void clear();
+    void drain (vector<inode_ptr>& nodes);
+    size_t size() const { return entries.size(); };
+    const dirent& any() const { return entries.front(); };
+    dirent_view view() const;
+};
+
+/**
+ *  Class dentry_cache
+ *  Static class. Remembers the result of looking a name up in a
+ *  directory, so trace_path can walk a path without searching
+ *  dirents or casting contents at every step.
+ *
+ *  Entries are keyed by (parent inode number, interned component), so
+ *  a probe hashes the name once, in the name_table. A hit holds the
+ *  number of the inode found, resolved through inode::find(), or 0 if
+ *  the name did not exist. Directory mkdir, mkfile, and remove
+ *  invalidate exactly the name they change; a destroyed directory
+ *  drops all of its entries.
+ *
+ *  Methods:
+ *  lookup()        True on a hit. Sets result, nullptr if negative.
+ *  insert()        Remember a lookup. A nullptr target is negative.
+ *  invalidate()    Forget one name in one directory.
+ *  forget()        Forget every name in one directory.
+ */
+class dentry_cache {
+private:
+    struct dentry {
+        interned_name name;
+        int target_nr;
+    };
+    using dentry_map = unordered_map<const name_table::entry*,dentry>;
+    static unordered_map<int,dentry_map> table;
+    static size_t entries;
+    static const size_t max_entries;
+public:
+    static bool lookup (int dir_nr, const string& name, inode_ptr& result);
+    static void insert (int dir_nr, const string& name, const inode_ptr& target);
+    static void invalidate (int dir_nr, const string& name);
+    static void forget (int dir_nr);
+};
+
+/**
+ *  Class copy_views
+ *  Static class. The stand-ins lookup() hands out for the children of
+ *  a copy that still shares its dirent table: a clone of the one child,
+ *  parented to the copy but in no table. Keyed like dentry_cache. The
+ *  views are held here until the copy unshares or goes away, so a path
+ *  of them stays whole and a name read again gets the same inode.
+ *  unshare() puts each view into the copy's own table in place of a
+ *  fresh clone, so an inode handed out earlier is the one written.
+ *
+ *  Methods:
+ *  find()          The view of a name in a directory, or nullptr.
+ *  add()           Remember a view.
+ *  forget()        Forget every view of one directory.
+ */
+class copy_views {
+private:
+    using view_map = unordered_map<const name_table::entry*,inode_ptr>;
+    static unordered_map<int,view_map> table;
+public:
+    static inode_ptr find (int dir_nr, const string& name);
+    static void add (int dir_nr, const string& name, const inode_ptr& view);
+    static void forget (int dir_nr);
+};
+
+/**
+ *  Class name_index
+ *  Static class. For each interned name, the numbers of the live inodes
+ *  that have it, so find goes from a name to its inodes without
+ *  walking the tree. The inode constructor and destructor keep it.
+ *
+ *  Some directories hide entries from it: one not yet loaded from an
+ *  image, whose children are not inodes yet, and a copy still sharing
+ *  a dirent table whose children name the original as parent. These
+ *  are remembered as unindexed, and find and grep walk them instead.
+ *  The set is pruned as they come across entries that no longer apply.
+ *
+ *  Methods:
+ *  add()           Index an inode under its name.
+ *  remove()        Drop it again.
+ *  rename()        Move an inode from one name to another, as mv does.
+ *  match()         Numbers of the inodes whose names match a glob.
+ *  add_unindexed() Remember a directory the index cannot see into.
+ */
+class name_index {
+private:
+    static unordered_map<const name_table::entry*,unordered_set<int>> inodes;
+    static unordered_set<int> unindexed;
+public:
+    static void add (const interned_name& name, int inode_nr);
+    static void remove (const interned_name& name, int inode_nr);
+    static void rename (const interned_name& from, const interned_name& to, int inode_nr);
+    static vector<int> match (const string& pattern);
+    static void add_unindexed (int inode_nr) { unindexed.insert(inode_nr); };
+    static unordered_set<int>& get_unindexed() { return unindexed; };
+};
+
+/**
+ *  Class content_index
+ *  Static class. An inverted index over the contents of plain files:
+ *  for each token, a run of letters, digits and underscores, the
+ *  numbers of the files that contain it. grep intersects the posting
+ *  sets of the tokens every match must hold whole to find the files
+ *  worth reading.
+ *
+ *  Changing a file only notes its number as pending. The reclaimer
+ *  thread indexes pending files in batches between commands, and grep
+ *  catches up on whatever is left, so make and append never tokenize.
+ *  A file that went away is dropped the same way.
+ *
+ *  Methods:
+ *  changed()       Note that a file's contents changed, or that it is gone.
+ *  backlog()       Whether any file is pending.
+ *  update()        Index up to budget pending files.
+ *  lookup()        Numbers of the files containing all of these tokens.
+ *  tokenize()      The distinct tokens in some text, in order of appearance.
+ */
+class content_index {
+private:
+    static const size_t batch_size;
+    static unordered_map<string,unordered_set<int>> postings;
+    static unordered_map<int,vector<const string*>> indexed;
+    static unordered_set<int> pending;
+    static void unindex (int inode_nr);
+public:
+    static void changed (int inode_nr);
+    static bool backlog() { return !pending.empty(); };
+    static void update (size_t budget);
+    static unordered_set<int> lookup (const wordvec& tokens);
+    static wordvec tokenize (const string& text);
+};
+
 /**
  *  Class inode_state
  *  An inconvenient class.
@@ -68,6 +411,7 @@ public:
  *  shared_ptr<inode> root  This class always points to the root directory,
  *  shared_ptr<inode> cwd   and the current working directory.
  *  string prompt_          Display prompt. Probably not a good naming convention.
+ *  map snapshots           Named copies of root, made by snapshot() in O(1).
  *
  *  Constructors:
  *  Default - Singleton. Creates the root directory.
@@ -75,6 +419,10 @@ public:
  *
  *  Method:
  *  prompt()                Bad convention. fix: get_prompt(). Returns prompt string.
+ *  save()                  Write the whole tree to an image file.
+ *  load()                  Make the tree in an image file the current one. cwd goes to root.
+ *  snapshot()              Remember the whole tree under a name.
+ *  restore()               Make a remembered tree the current one. cwd goes to root.
  */
 class inode_state {
     friend class inode;
@@ -83,6 +431,7 @@ private:
     inode_ptr root {nullptr};
     inode_ptr cwd {nullptr};
     string prompt_ {"% "};
+    map<string,inode_ptr> snapshots;
 public:
     // ♠ Implemented in cpp
     inode_state();
@@ -94,48 +443,15 @@ public:
     void set_cwd(inode_ptr toSet){ cwd = toSet; };
     inode_ptr get_cwd(){ return cwd; };
     inode_ptr get_root(){ return root; };
+    void save (const string& filename);
+    void load (const string& filename);
+    void snapshot (const string& name);
+    void restore (const string& name);
+    void checkpoint (const string& filename, uint64_t generation);
+    uint64_t recover (const string& filename);
+    const map<string,inode_ptr>& get_snapshots() const { return snapshots; };
 };
 
-/**
- *  Class inode
- *  Instances of this class are a simulated file or a direcotry.
- *
- *  Fields:
- *  static int next_inode_nr        Class variable. Increament by 1 when an instance is created.
- *  int inode_nr                    Unique number for all instance.
- *  shared_ptr<base_file> contents  This field holds the data, either a direcotry or strings.
- *
- *  Constrcutors:
- *  Default - supressed.
- *  (enum class file_type)  Create inode with contents be either class directory or plain_file.
- *
- *  Methods:
- *  get_size()  Returns the sum file character or number of dirents.
- */
-class inode {
-    friend class inode_state;
-private:
-    static int next_inode_nr;
-    int inode_nr;
-    base_file_ptr contents;
-    file_type this_type;
-public:
-    // ♠ Implemented in cpp
-    inode (file_type type);
-    string get_full_path();
-    size_t get_size();
-    string get_name();
-    void print_contents(bool recursive);
-    directory_ptr get_directory_access ();
-    plain_file_ptr get_plain_file_access ();
-    
-    // ♥ In line methods
-    int get_inode_nr() const { return inode_nr; };
-    file_type get_this_type(){ return this_type; };
-
-};
-
-
 /**
  *  Class base_file
  *  This an abstract class.
@@ -149,78 +465,292 @@ public:
     base_file& operator= (const base_file&) = delete;
     virtual ~base_file() = default;
     virtual size_t size() const = 0;
-    virtual const wordvec& readfile() const = 0;
+    virtual wordvec readfile() const = 0;
     virtual void writefile (const wordvec& newdata) = 0;
     virtual void remove (const string& filename, bool recursive) = 0;
     virtual inode_ptr mkdir (const string& dirname, inode_ptr parent) = 0;
-    virtual inode_ptr mkfile (const string& filename, const string& content) = 0;
+    virtual inode_ptr mkfile (const string& filename, const string& content, inode_ptr parent) = 0;
 };
 
 /**
  *  Class plain_file
  *  This class is for the inode content field.
  *
+ *  The content is a list of chunks, read in order: sealed chunks are
+ *  shared blobs in the blob_store, so identical content is stored
+ *  once, and the tail is this file's own. Appends go to the tail,
+ *  which is sealed into a blob when it reaches chunk_size, so a file
+ *  that grows by small appends is never copied, and a large file is
+ *  never one contiguous string. writefile() seals everything it writes.
+ *
+ *  As written by make, content ends in a separator space that size()
+ *  does not count. append_line() keeps that shape.
+ *
+ *  Every change is reported to the content_index.
+ *
  *  Fields:
- *  vector<string> data     For holding string data.
+ *  vector<blob> chunks     Sealed content.
+ *  string tail             Content appended since the last seal.
+ *  size_t bytes            Total length of chunks and tail.
+ *  int inode_nr            Number of the inode holding this file.
  *
  *  Methods:
- *  readfile()      Basically get_data();
- *  writefile()     Basically set_data();
+ *  readfile()      The content, in pieces. Copies it; cat uses write_to().
+ *  write_to()      Print the content.
+ *  str()           The content as one string.
+ *  writefile()     Replace the content with these pieces.
+ *  append_line()   Add a line of text after the content.
+ *  copy_from()     Take the content of another file, sharing its blobs.
  *  remove()        Should not remove a directory on a file. throw error
  *  mkdir()         Should not make a directory on a file. throw error
  *  mkfile()        Should not make file on a file. throw error
  */
-class plain_file: public base_file {
+class plain_file final: public base_file {
 private:
-    wordvec data;
+    static const size_t chunk_size = 4096;
+    vector<blob> chunks;
+    string tail;
+    size_t bytes {0};
+    int inode_nr;
+    void append (const string& text);
+    void seal();
 public:
+    // ♠ Implemented in cpp
+    plain_file (int inode_nr): inode_nr(inode_nr) {};
+    ~plain_file();
+    wordvec readfile() const override;
+    void write_to (ostream& out) const;
+    string str() const;
+    void writefile (const wordvec& newdata) override;
+    void append_line (const string& text);
+    void copy_from (const plain_file& that);
+
     // ♥ In line methods
     inode_ptr mkdir (const string& dirname, inode_ptr parent) override { throw file_error("Is a file");};
-    inode_ptr mkfile (const string& filename, const string& content) override{ throw file_error("Is a file");};
+    inode_ptr mkfile (const string& filename, const string& content, inode_ptr parent) override{ throw file_error("Is a file");};
     void remove (const string& filename, bool recursive) override{ throw file_error("Is a file"); };
-    size_t size() const override { return this->data[1].length() -1; };
-    string get_name(){ return data[0]; };
-    const wordvec& readfile() const override { return data; };
-    void writefile (const wordvec& newdata) override { data = newdata; };
+    size_t size() const override { return bytes == 0 ? 0 : bytes - 1; };
+    size_t length() const { return bytes; };
 };
 
 /**
  *  Class directory
  *  This class is for the inode content field.
  *
+ *  The dirent table may be shared with copies of this directory, made
+ *  by cp -r or snapshot. A shared table is never changed: unshare()
+ *  gives this directory a table of its own first, and every change goes
+ *  through it. Subdirectories stay shared until a change below reaches
+ *  them in turn, so only the path that is written gets copied; reads
+ *  copy nothing but the one child they return (see copy_views).
+ *
+ *  A directory loaded from an image has no dirents until first used:
+ *  backing points at its record, and load() reads the entries in,
+ *  making unloaded directories of its subdirectories in turn.
+ *
  *  Fields:
- *  map<string,inode_ptr> dirents     For holding {title:inode}.
+ *  shared_ptr<dirent_table> dirents  For holding {title:inode}.
+ *  shared_ptr<image> backing         The image to load dirents from, or nullptr once loaded.
+ *  uint64_t backing_offset           Where this directory's record is in the image.
+ *  int inode_nr                      Number of the inode holding this directory.
+ *  subtree_totals totals             Totals for everything under this directory.
+ *  subtree_totals reported           The part of totals already added into the parent's.
+ *  bool unsettled                    Whether totals != reported is queued for the parent.
  *
  *  Methods:
  *  readfile()          Should not readfile from a directory. throw error
  *  writefile()         Should not writefile to a direcotry. throw error
- *  remove(name)        Remove all dirents iff dirents are (.) and (..)
- *  mkdir(name)         Creates a new directory under current directory with (.) and (..) in it.
+ *  remove(name)        Remove a dirent, and a directory only if it is empty or recursive.
+ *  mkdir(name)         Creates a new, empty directory under current directory.
  *  mkfile(name)        Create a new empty file with given name. throw error if name exists.
+ *  mkcopy(name)        Puts a copy of an inode under the given name.
+ *  relink(name)        Moves an inode here from its parent, under the given name.
+ *  get_dirents()       A dirent_view over the dirents, without copying them.
+ *  unshare()           Make the dirent table this directory's own.
+ *  adopt()             Take over entries left parented nowhere in a table no longer shared.
+ *  back_with()         Leave the dirents to be loaded from an image record.
+ *  release()           Free inodes from a work list, a few at a time if need be.
  */
-class directory: public base_file {
+class directory final: public base_file {
+    friend class inode;
 private:
-    map<string,inode_ptr> dirents;
-    string name;
+    shared_ptr<dirent_table> dirents;
+    shared_ptr<image> backing;
+    uint64_t backing_offset {0};
+    int inode_nr;
+    subtree_totals totals {0, 1};
+    subtree_totals reported {0, 1};
+    bool unsettled {false};
+    void materialize();
+    void adopt();
+    void child_added (const inode_ptr& child);
+    void child_removed (const inode_ptr& child);
+    void load() { if (backing != nullptr) materialize(); };
 public:
     // ♠ Implemented in cpp
+    directory (int inode_nr): dirents(make_shared<dirent_table>()), inode_nr(inode_nr) {};
+    ~directory();
     void remove (const string& filename, bool recursive) override;
     inode_ptr mkdir (const string& dirname, inode_ptr parent) override;
-    inode_ptr mkfile (const string& filename, const string& content) override;
+    inode_ptr mkfile (const string& filename, const string& content, inode_ptr parent) override;
     plain_file_ptr get_file (string file_name);
     directory_ptr get_dir_in_dirents (string dir_name);
     inode_ptr get_inode_in_dirents(string dir_name);
+    void insert_dirent(const string& name, inode_ptr toInsert);
+    inode_ptr mkcopy (const string& name, const inode_ptr& source, inode_ptr parent);
+    void relink (const string& name, const inode_ptr& source, inode_ptr parent);
+    void unshare();
+    void back_with (const shared_ptr<image>& source, uint64_t offset);
+    size_t size() const override;
+    static void release (vector<inode_ptr>& doomed, size_t budget);
     
     // ♥ In line methods
-    const wordvec& readfile() const override { throw file_error("Is a directory"); };
+    wordvec readfile() const override { throw file_error("Is a directory"); };
     void writefile (const wordvec& newdata) override { throw file_error("Is a directory"); };
-    size_t size() const override { return dirents.size(); };
-    string get_name(){ return name; };
-    void insert_dirent(string name, inode_ptr toInsert){ dirents.insert(std::pair<string, inode_ptr>(name, toInsert)); };
-    void set_name(string toSet) { name = toSet; };
-    const map<string,inode_ptr> get_dirents() { return dirents; };
-    bool check_filename(const string& filename) { return this->dirents.find(filename) != this->dirents.end(); };
+    dirent_view get_dirents() { load(); return dirents->view(); };
+    bool check_filename(const string& filename) {
+        load();
+        return filename == "." || filename == ".." || dirents->find(filename) != nullptr;
+    };
 };
 
+/**
+ *  Class inode
+ *  Instances of this class are a simulated file or a direcotry.
+ *
+ *  Ownership runs one way, down the tree: a directory's dirents hold
+ *  the only owning pointers to its children, and the parent pointer is
+ *  weak. (.) and (..) are not stored at all; lookup() answers them
+ *  from this inode and its parent. So removing a dirent frees the
+ *  subtree under it at once, unless cwd is still inside it. Such a
+ *  cwd has no path any more: the removed inode is marked unlinked, its
+ *  freed ancestors leave expired parent pointers, and get_full_path()
+ *  and (..) report it removed rather than ending at the root.
+ *
+ *  A copy made by clone() shares its contents with the original (see
+ *  class directory), so the children in its dirent table still name
+ *  the original as parent. lookup() notices, and hands out a clone of
+ *  the child parented here instead, leaving the table as it is.
+ *
+ *  An inode found earlier (cwd, or a path resolved before a copy was
+ *  made) may since have become reachable from a copy, and such a clone
+ *  is in no table yet. Each directory clone bumps copy_epoch, a clone
+ *  from lookup() starts out stale, and make_writable() unshares every
+ *  directory from the top down to a stale inode before it is changed.
+ *
+ *  Inodes come from a slab, through create(), with the control block
+ *  and the contents in the same block: one allocation per file, and no
+ *  cast to reach the contents. by_number finds a live inode from its
+ *  number in O(1).
+ *
+ *  Fields:
+ *  static int next_inode_nr        Class variable. Increament by 1 when an instance is created.
+ *  static vector<inode*> by_number Live inodes, indexed by inode_nr. Freed ones are nullptr.
+ *  int inode_nr                    Unique number for all instance.
+ *  directory dir / plain_file file The contents, stored inline. this_type says which one is live.
+ *  bool unlinked                   Set when this inode's dirent is removed.
+ *  bool parented                   Whether this inode was ever given a parent.
+ *  weak_ptr<inode> parent          The directory holding this inode. Empty for the root.
+ *  interned_name name              The name of this inode in its parent's dirents.
+ *  unsigned long write_epoch       The copy_epoch when this inode was last made writable.
+ *  string full_path                Memoized result of get_full_path(), valid while
+ *                                  full_path_generation equals path_generation.
+ *
+ *  Constrcutors:
+ *  Default - supressed.
+ *  (file_type, name, parent)  Create inode with contents be either class directory or plain_file.
+ *                             Use create(), which allocates from the slab.
+ *
+ *  Methods:
+ *  create()            Returns a new inode, allocated from the slab.
+ *  find()              Returns the live inode with this number, or nullptr.
+ *  clone()             Returns a new inode with the same contents, shared where possible.
+ *  make_writable()     Call before changing this inode or its contents.
+ *  get_size()          Returns the sum file character or number of dirents.
+ *  get_full_path()     Absolute path, found through the parent pointers and memoized.
+ *                      Throws if this inode, or a directory above it, was removed.
+ *  invalidate_paths()  Forget every memoized path. Called on remove and rename.
+ *  lookup()            Returns the inode named in this directory, through the dentry_cache.
+ *                      (.) is this inode, and (..) its parent, or itself for the root.
+ *  get_totals()        Bytes and inodes in the subtree, without walking it. See settle_totals().
+ *  resized()           Call after a file's contents change, with its old size.
+ *  settle_totals()     Carry queued changes up to the ancestors.
+ *  find_names()        Paths below this directory with names matching a glob. See name_index.
+ *  find_files()        Paths and inodes of the files below this one containing some tokens.
+ *
+ *  Subtree totals are kept per directory. A change below a directory is
+ *  added to its totals at once, and the directory is queued; the change
+ *  reaches the ancestors only when settle_totals() runs, deepest
+ *  directories first, so one settle covers any number of changes and a
+ *  deep tree costs one walk per batch rather than one per change.
+ */
+class inode: public enable_shared_from_this<inode> {
+    friend class inode_state;
+    friend class directory;
+private:
+    static int next_inode_nr;
+    static unsigned long path_generation;
+    static vector<inode*> by_number;
+    static unsigned long copy_epoch;
+    static priority_queue<pair<size_t,int>> unsettled;
+    int inode_nr;
+    size_t depth;
+    file_type this_type;
+    bool unlinked {false};
+    bool parented;
+    union {
+        directory dir;
+        plain_file file;
+    };
+    weak_ptr<inode> parent;
+    interned_name name;
+    unsigned long write_epoch {copy_epoch};
+    string full_path;
+    unsigned long full_path_generation {0};
+    void print_listing (buffered_writer& out, const string& path, size_t parent_size,
+                        const subtree_totals* parent_totals = nullptr);
+    struct listing;
+    static void run_listing (const shared_ptr<listing>& task);
+    void print_parallel (buffered_writer& out, const string& path, size_t parent_size);
+    void mark_unsettled();
+    bool reaches (const inode* ancestor);
+    int listed_nr();
+    bool lost_parent() const;
+    bool is_unindexed();
+    using visitor = function<void(const string& path, const inode_ptr& node)>;
+    void walk (const visitor& visit);
+    void walk_unindexed (const visitor& visit);
+public:
+    // ♠ Implemented in cpp
+    inode (file_type type, const string& name, inode_ptr parent);
+    inode (const inode&) = delete;
+    inode& operator= (const inode&) = delete;
+    ~inode();
+    static inode_ptr create (file_type type, const string& name, inode_ptr parent);
+    static inode_ptr find (int inode_nr);
+    inode_ptr clone (inode_ptr parent, const string& name);
+    void make_writable();
+    string get_full_path();
+    size_t get_size();
+    string get_name();
+    inode_ptr lookup (const string& name);
+    void print_contents(bool recursive, bool totals = false);
+    subtree_totals get_totals();
+    void resized (size_t old_size);
+    static void settle_totals();
+    vector<string> find_names (const string& pattern);
+    vector<pair<string,inode_ptr>> find_files (const wordvec& tokens);
+    directory_ptr get_directory_access ();
+    plain_file_ptr get_plain_file_access ();
+    
+    // ♥ In line methods
+    int get_inode_nr() const { return inode_nr; };
+    file_type get_this_type(){ return this_type; };
+    inode_ptr get_parent() const { return parent.lock(); };
+    static void invalidate_paths() { ++path_generation; };
+
+};
+
+
 #endif
 
@@ -0,0 +1,233 @@
+// $Id: image.cpp,v 1.1 2016-04-07 13:36:11-07 - - $
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "image.h"
+
+static const char magic[] = "YSHIMG02";
+static const size_t header_size = 16;
+static const uint32_t plain_record = 0;
+static const uint32_t directory_record = 1;
+static const size_t directory_header_size = 24;
+
+/**
+ * Sequential writer that knows its offset and pads records to 8 bytes.
+ * It writes beside the file and renames over it on close, so an image
+ * still mapped by unloaded directories is never truncated under them.
+ */
+class image_writer {
+private:
+    string filename;
+    string temporary;
+    ofstream out;
+    uint64_t offset {0};
+public:
+    image_writer (const string& filename): filename(filename),
+            temporary(filename + ".tmp"), out(temporary, ios::binary) {
+        if (!out) {
+            throw file_error("Cannot create image");
+        }
+    }
+    ~image_writer() {
+        if (out.is_open()) {
+            out.close();
+            unlink(temporary.c_str());
+        }
+    }
+    uint64_t tell() const { return offset; }
+    void bytes (const char* text, size_t count) {
+        out.write(text, count);
+        offset += count;
+    }
+    template <typename T>
+    void put (T value) {
+        bytes(reinterpret_cast<const char*>(&value), sizeof value);
+    }
+    void align() {
+        static const char zeros[8] {};
+        bytes(zeros, (8 - offset % 8) % 8);
+    }
+    void patch (uint64_t at, uint64_t value) {
+        out.seekp(at);
+        out.write(reinterpret_cast<const char*>(&value), sizeof value);
+    }
+    void close() {
+        out.close();
+        if (!out || rename(temporary.c_str(), filename.c_str()) != 0) {
+            unlink(temporary.c_str());
+            throw file_error("Cannot write image");
+        }
+    }
+};
+
+/**
+ * Writes the tree children first, with an explicit stack, so a deep
+ * tree does not recurse. Unloaded directories are read in as they are
+ * reached. Subtree totals are summed on the way back up.
+ */
+void image::save (const inode_ptr& root, const string& filename) {
+    struct frame {
+        inode_ptr dir;
+        dirent_view entries;
+        dirent_vec::const_iterator next;
+        vector<uint64_t> offsets;
+        subtree_totals totals;
+    };
+    image_writer writer (filename);
+    writer.bytes(magic, 8);
+    writer.put<uint64_t>(0);
+    uint64_t root_offset = 0;
+    vector<frame> stack;
+    dirent_view top = root->get_directory_access()->get_dirents();
+    stack.push_back(frame {root, top, top.begin(), {}, {0, 1}});
+    while (!stack.empty()) {
+        frame& current = stack.back();
+        if (current.next != current.entries.end()) {
+            const inode_ptr& child = current.next->node;
+            ++current.next;
+            if (child->get_this_type() == file_type::DIRECTORY_TYPE) {
+                dirent_view entries = child->get_directory_access()->get_dirents();
+                stack.push_back(frame {child, entries, entries.begin(), {}, {0, 1}});
+            } else {
+                current.offsets.push_back(writer.tell());
+                plain_file_ptr file = child->get_plain_file_access();
+                current.totals.bytes += file->size();
+                current.totals.inodes += 1;
+                writer.put<uint32_t>(plain_record);
+                writer.put<uint32_t>(0);
+                writer.put<uint64_t>(file->length());
+                for (const auto& piece: file->readfile()) {
+                    writer.bytes(piece.data(), piece.size());
+                }
+                writer.align();
+            }
+            continue;
+        }
+        uint64_t offset = writer.tell();
+        writer.put<uint32_t>(directory_record);
+        writer.put<uint32_t>(current.entries.size());
+        writer.put<uint64_t>(current.totals.bytes);
+        writer.put<uint64_t>(current.totals.inodes);
+        size_t index = 0;
+        for (const auto& entry: current.entries) {
+            writer.put<uint64_t>(current.offsets[index++]);
+            writer.put<uint32_t>(static_cast<uint32_t>(entry.node->get_this_type()));
+            writer.put<uint32_t>(entry.name.str().size());
+        }
+        for (const auto& entry: current.entries) {
+            writer.bytes(entry.name.str().data(), entry.name.str().size());
+        }
+        writer.align();
+        subtree_totals totals = current.totals;
+        stack.pop_back();
+        if (stack.empty()) {
+            root_offset = offset;
+        } else {
+            stack.back().offsets.push_back(offset);
+            stack.back().totals.bytes += totals.bytes;
+            stack.back().totals.inodes += totals.inodes;
+        }
+    }
+    writer.patch(8, root_offset);
+    writer.close();
+}
+
+shared_ptr<image> image::open (const string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw file_error(strerror(errno));
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < header_size) {
+        ::close(fd);
+        throw file_error("Not an image");
+    }
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw file_error(strerror(errno));
+    }
+    shared_ptr<image> result (new image());
+    result->data = static_cast<const char*>(mapped);
+    result->length = info.st_size;
+    if (memcmp(result->data, magic, 8) != 0) {
+        throw file_error("Not an image");
+    }
+    return result;
+}
+
+image::~image() {
+    if (data != nullptr) {
+        munmap(const_cast<char*>(data), length);
+    }
+}
+
+/**
+ * Reads one value, checking it lies inside the file.
+ */
+template <typename T>
+T image::read (uint64_t offset) const {
+    if (offset > length || length - offset < sizeof(T)) {
+        throw file_error("Corrupt image");
+    }
+    T value;
+    memcpy(&value, data + offset, sizeof value);
+    return value;
+}
+
+uint64_t image::root() const {
+    return read<uint64_t>(8);
+}
+
+uint32_t image::directory_size (uint64_t offset) const {
+    return read<uint32_t>(offset + 4);
+}
+
+subtree_totals image::directory_totals (uint64_t offset) const {
+    return subtree_totals {read<uint64_t>(offset + 8), read<uint64_t>(offset + 16)};
+}
+
+vector<image::entry> image::read_directory (uint64_t offset) const {
+    if (read<uint32_t>(offset) != directory_record) {
+        throw file_error("Corrupt image");
+    }
+    uint32_t count = read<uint32_t>(offset + 4);
+    uint64_t names = offset + directory_header_size + uint64_t(count) * 16;
+    vector<entry> entries;
+    entries.reserve(count);
+    for (uint32_t index = 0; index < count; ++index) {
+        uint64_t at = offset + directory_header_size + uint64_t(index) * 16;
+        uint32_t type = read<uint32_t>(at + 8);
+        uint32_t name_length = read<uint32_t>(at + 12);
+        if (names > length || length - names < name_length) {
+            throw file_error("Corrupt image");
+        }
+        entries.push_back(entry {string(data + names, name_length),
+                                 type == directory_record ? file_type::DIRECTORY_TYPE
+                                                          : file_type::PLAIN_TYPE,
+                                 read<uint64_t>(at)});
+        names += name_length;
+    }
+    return entries;
+}
+
+string image::read_file (uint64_t offset) const {
+    if (read<uint32_t>(offset) != plain_record) {
+        throw file_error("Corrupt image");
+    }
+    uint64_t size = read<uint64_t>(offset + 8);
+    if (offset + 16 > length || length - offset - 16 < size) {
+        throw file_error("Corrupt image");
+    }
+    return string(data + offset + 16, size);
+}
+
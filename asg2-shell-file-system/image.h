@@ -0,0 +1,67 @@
+// $Id: image.h,v 1.1 2016-04-07 13:36:11-07 - - $
+
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "file_sys.h"
+
+/**
+ *  Class image
+ *  A saved inode tree, mapped read-only into memory.
+ *
+ *  The file holds one record per inode, children before parents, with
+ *  every reference an offset from the start of the file, so it can be
+ *  mapped anywhere. All integers are in host byte order.
+ *
+ *  header      "YSHIMG02", u64 offset of the root record
+ *  plain file  u32 0, u32 0, u64 length, the bytes
+ *  directory   u32 1, u32 count, u64 subtree bytes, u64 subtree inodes,
+ *              count * {u64 offset, u32 type, u32 name length},
+ *              then the names, in name order
+ *
+ *  Every record starts on an 8-byte boundary. Nothing is read until a
+ *  directory asks for its entries, so loading an image costs one mmap;
+ *  directories are filled in as they are reached (see class directory).
+ *
+ *  Methods:
+ *  save()              Write the tree under root to a file.
+ *  open()              Map a file. throws file_error if it is not an image.
+ *  root()              Offset of the root directory's record.
+ *  directory_size()    Number of entries in a directory record.
+ *  directory_totals()  Subtree totals stored with a directory record.
+ *  read_directory()    The entries of a directory record.
+ *  read_file()         The contents of a plain file record.
+ */
+class image {
+public:
+    struct entry {
+        string name;
+        file_type type;
+        uint64_t offset;
+    };
+private:
+    const char* data {nullptr};
+    size_t length {0};
+    image() = default;
+    template <typename T> T read (uint64_t offset) const;
+public:
+    image (const image&) = delete;
+    image& operator= (const image&) = delete;
+    ~image();
+    static void save (const inode_ptr& root, const string& filename);
+    static shared_ptr<image> open (const string& filename);
+    uint64_t root() const;
+    uint32_t directory_size (uint64_t offset) const;
+    subtree_totals directory_totals (uint64_t offset) const;
+    vector<entry> read_directory (uint64_t offset) const;
+    string read_file (uint64_t offset) const;
+};
+
+#endif
+
@@ -0,0 +1,276 @@
+// $Id: journal.cpp,v 1.1 2016-04-07 13:36:11-07 - - $
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "journal.h"
+
+static const char magic[] = "YSHJRN01";
+static const size_t header_size = 16;
+static const size_t record_header_size = 8;
+
+const size_t journal::group_bytes;
+const size_t journal::group_records;
+const size_t journal::compact_every;
+string journal::filename;
+int journal::fd {-1};
+journal::sync_policy journal::policy {journal::sync_policy::GROUP};
+string journal::pending;
+size_t journal::pending_records {0};
+size_t journal::since_compaction {0};
+uint64_t journal::generation {0};
+
+/**
+ * FNV-1a, enough to tell a torn record from a whole one.
+ */
+static uint32_t checksum (const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t index = 0; index < size; ++index) {
+        hash = (hash ^ static_cast<unsigned char>(data[index])) * 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+static void put (string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+template <typename T>
+static bool get (const string& in, size_t& offset, T& value) {
+    if (in.size() - offset < sizeof value) {
+        return false;
+    }
+    memcpy(&value, in.data() + offset, sizeof value);
+    offset += sizeof value;
+    return true;
+}
+
+static void write_all (int fd, const string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t count = ::write(fd, data.data() + done, data.size() - done);
+        if (count < 0 && errno != EINTR) {
+            throw file_error(string("journal: ") + strerror(errno));
+        }
+        if (count > 0) {
+            done += count;
+        }
+    }
+}
+
+static bool exists (const string& path) {
+    struct stat info;
+    return ::stat(path.c_str(), &info) == 0;
+}
+
+static void sync_file (const string& path) {
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file >= 0) {
+        fsync(file);
+        ::close(file);
+    }
+}
+
+journal::sync_policy journal::parse_policy (const string& name) {
+    if (name == "always") return sync_policy::ALWAYS;
+    if (name == "group") return sync_policy::GROUP;
+    if (name == "never") return sync_policy::NEVER;
+    throw file_error(name + ": unknown sync policy");
+}
+
+/**
+ * Replays the records in a journal file's contents, with output
+ * thrown away, and returns the length of the good prefix.
+ */
+size_t journal::replay (inode_state& state, const string& contents, replay_fn fn) {
+    size_t offset = header_size;
+    streambuf* saved = cout.rdbuf(nullptr);
+    for (;;) {
+        size_t start = offset;
+        uint32_t length, sum;
+        if (!get(contents, offset, length) || !get(contents, offset, sum) ||
+            contents.size() - offset < length ||
+            checksum(contents.data() + offset, length) != sum) {
+            offset = start;
+            break;
+        }
+        size_t at = offset;
+        offset += length;
+        uint8_t kind;
+        uint32_t count;
+        get(contents, at, kind);
+        get(contents, at, count);
+        wordvec words (count);
+        for (auto& word: words) {
+            uint32_t size;
+            get(contents, at, size);
+            word.assign(contents, at, size);
+            at += size;
+        }
+        try {
+            fn(state, static_cast<record_kind>(kind), words);
+        } catch (runtime_error&) {
+            // It failed the same way the first time.
+        }
+        ++since_compaction;
+    }
+    cout.rdbuf(saved);
+    cout.clear();
+    return offset;
+}
+
+/**
+ * Loads the last checkpoint, if there is one, replays the journal on
+ * top of it, and then opens the journal for appending. A new journal
+ * is only started in place of a missing or empty file, or of one the
+ * checkpoint has overtaken; anything else is left alone.
+ */
+void journal::open (inode_state& state, const string& name,
+                    sync_policy how, replay_fn fn) {
+    filename = name;
+    policy = how;
+    uint64_t image_generation = 0;
+    if (exists(filename + ".img")) {
+        image_generation = state.recover(filename + ".img");
+    }
+    generation = image_generation;
+    ifstream in (filename, ios::binary);
+    string contents ((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    if (contents.empty()) {
+        start(generation);
+        return;
+    }
+    uint64_t journal_generation = 0;
+    size_t at = 8;
+    if (contents.size() < header_size || contents.compare(0, 8, magic) != 0 ||
+        !get(contents, at, journal_generation)) {
+        throw file_error("not a journal");
+    }
+    if (journal_generation > image_generation) {
+        throw file_error("journal is newer than its checkpoint");
+    }
+    if (journal_generation == image_generation) {
+        size_t good = replay(state, contents, fn);
+        DEBUGF ('j', filename << ": replayed " << since_compaction << " records");
+        fd = ::open(filename.c_str(), O_WRONLY);
+        if (fd < 0 || ftruncate(fd, good) < 0 || lseek(fd, 0, SEEK_END) < 0) {
+            throw file_error(filename + ": " + strerror(errno));
+        }
+    } else {
+        // Older than the checkpoint, which already holds its records.
+        start(generation);
+    }
+}
+
+/**
+ * Replaces the journal with an empty one of the given generation.
+ */
+void journal::start (uint64_t new_generation) {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    string header (magic, 8);
+    put(header, new_generation);
+    string temporary = filename + ".tmp";
+    int file = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        throw file_error(filename + ": " + strerror(errno));
+    }
+    write_all(file, header);
+    fsync(file);
+    ::close(file);
+    if (rename(temporary.c_str(), filename.c_str()) < 0) {
+        throw file_error(filename + ": " + strerror(errno));
+    }
+    fd = ::open(filename.c_str(), O_WRONLY | O_APPEND);
+    if (fd < 0) {
+        throw file_error(filename + ": " + strerror(errno));
+    }
+    generation = new_generation;
+    since_compaction = 0;
+}
+
+void journal::record (record_kind kind, const wordvec& words) {
+    string payload;
+    put<uint8_t>(payload, kind);
+    put<uint32_t>(payload, words.size());
+    for (const auto& word: words) {
+        put<uint32_t>(payload, word.size());
+        payload += word;
+    }
+    put<uint32_t>(pending, payload.size());
+    put<uint32_t>(pending, checksum(payload.data(), payload.size()));
+    pending += payload;
+    ++pending_records;
+    ++since_compaction;
+    switch (policy) {
+        case sync_policy::ALWAYS:
+            commit();
+            break;
+        case sync_policy::GROUP:
+            if (pending_records >= group_records || pending.size() >= group_bytes) {
+                commit();
+            }
+            break;
+        case sync_policy::NEVER:
+            if (pending.size() >= group_bytes) {
+                write_all(fd, pending);
+                pending.clear();
+                pending_records = 0;
+            }
+            break;
+    }
+}
+
+void journal::commit() {
+    if (fd < 0 || pending.empty()) {
+        return;
+    }
+    write_all(fd, pending);
+    pending.clear();
+    pending_records = 0;
+    if (policy != sync_policy::NEVER) {
+        fdatasync(fd);
+    }
+}
+
+/**
+ * Checkpoints the tree under the next generation, then starts a new
+ * journal of that generation. Each step is a write to a temporary
+ * file and a rename, so a crash leaves one consistent pair or the
+ * other.
+ */
+void journal::compact (inode_state& state) {
+    commit();
+    string image_name = filename + ".img";
+    string temporary = image_name + ".tmp";
+    state.checkpoint(temporary, generation + 1);
+    sync_file(temporary);
+    if (rename(temporary.c_str(), image_name.c_str()) < 0) {
+        throw file_error(image_name + ": " + strerror(errno));
+    }
+    DEBUGF ('j', image_name << ": checkpoint " << generation + 1);
+    start(generation + 1);
+}
+
+void journal::close() {
+    commit();
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+        fd = -1;
+    }
+}
+
@@ -0,0 +1,74 @@
+// $Id: journal.h,v 1.1 2016-04-07 13:36:11-07 - - $
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#include "file_sys.h"
+#include "util.h"
+
+/**
+ *  Class journal
+ *  Static class. An append-only log of the commands that change the
+ *  tree, so a session can be rebuilt after a crash.
+ *
+ *  Records are appended to a buffer and written out together (group
+ *  commit). When they reach the disk depends on the sync policy:
+ *  ALWAYS      write and fsync after every record.
+ *  GROUP       write and fsync once enough records have gathered, and
+ *              whenever commit() is called.
+ *  NEVER       write when the buffer fills; leave flushing to the kernel.
+ *
+ *  Every compact_every records, the tree and snapshots are checkpointed
+ *  into FILE.img and the journal starts over. Both carry a generation
+ *  number, so a crash between the two steps cannot replay records the
+ *  image already holds.
+ *
+ *  File: "YSHJRN01", u64 generation, then records of
+ *  u32 length, u32 checksum, u8 kind, u32 count, count * {u32 length, bytes}.
+ *  A torn or corrupt record ends replay, and is cut off.
+ *
+ *  Methods:
+ *  open()      Recover from FILE.img and FILE, then log to FILE. Throws,
+ *              leaving FILE alone, if it is not a journal or is newer
+ *              than FILE.img.
+ *  record()    Log one change. Paths in it must be absolute.
+ *  commit()    Write and, by policy, fsync what is buffered.
+ *  compact()   Checkpoint and start a new journal.
+ *  close()     Commit and close.
+ */
+class journal {
+public:
+    enum class sync_policy {ALWAYS, GROUP, NEVER};
+    enum record_kind: uint8_t {COMMAND = 0, APPEND = 1};
+    using replay_fn = void (*)(inode_state& state, record_kind kind, const wordvec& words);
+private:
+    static const size_t group_bytes = 1 << 16;
+    static const size_t group_records = 512;
+    static const size_t compact_every = 1 << 17;
+    static string filename;
+    static int fd;
+    static sync_policy policy;
+    static string pending;
+    static size_t pending_records;
+    static size_t since_compaction;
+    static uint64_t generation;
+    static void start (uint64_t generation);
+    static size_t replay (inode_state& state, const string& contents, replay_fn fn);
+public:
+    static bool enabled() { return fd >= 0; };
+    static sync_policy parse_policy (const string& name);
+    static void open (inode_state& state, const string& filename,
+                      sync_policy policy, replay_fn fn);
+    static void record (record_kind kind, const wordvec& words);
+    static void commit();
+    static bool compaction_due() { return since_compaction >= compact_every; };
+    static void compact (inode_state& state);
+    static void close();
+};
+
+#endif
+
@@ -1,7 +1,11 @@
 // $Id: main.cpp,v 1.9 2016-01-14 16:16:52-08 - - $
 
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <utility>
 #include <unistd.h>
@@ -11,21 +15,55 @@ using namespace std;
 #include "commands.h"
 #include "debug.h"
 #include "file_sys.h"
+#include "journal.h"
+#include "pool.h"
 #include "util.h"
 
 
+// Image to load at startup, from -i.
+string image_file;
+
+// Journal to recover from and log to, from -j, and its sync policy, from -s.
+string journal_file;
+journal::sync_policy journal_sync = journal::sync_policy::GROUP;
+
+// Script to run in batch mode, from -f; "-" is the standard input.
+string script_file;
+
+// Threads for lsr and rmr, from -t. One means the serial walks.
+size_t threads = 1;
+
 /**
  * This function scans command line arugment and activates the debug tools
  */
 void scan_options (int argc, char** argv) {
     opterr = 0;
     for (;;) {
-        int option = getopt (argc, argv, "@:");
+        int option = getopt (argc, argv, "@:f:i:j:s:t:");
         if (option == EOF) break;
         switch (option) {
             case '@':
                 debugflags::setflags (optarg);
                 break;
+            case 'f':
+                script_file = optarg;
+                break;
+            case 'i':
+                image_file = optarg;
+                break;
+            case 'j':
+                journal_file = optarg;
+                break;
+            case 's':
+                try {
+                    journal_sync = journal::parse_policy (optarg);
+                } catch (file_error& error) {
+                    complain() << "-s: " << error.what() << endl;
+                }
+                break;
+            case 't':
+                threads = strtoul (optarg, nullptr, 10);
+                break;
             default:
                 complain() << "-" << static_cast<char> (option)
                 << ": invalid option" << endl;
@@ -43,45 +81,93 @@ int main (int argc, char** argv) {
     execname (argv[0]);
     cout << boolalpha;
     cerr << boolalpha;
-    cout << argv[0] << " build " << __DATE__ << " " << __TIME__ << endl;
     
     // Enable debug tool if needed.
     scan_options (argc, argv);
-    bool need_echo = want_echo();
+    
+    // A batch run has no banner, prompts, or echo, reads its script a
+    // block at a time, and holds its output until exit or sync.
+    bool batch = !script_file.empty();
+    int script_fd = 0;
+    if (batch && script_file != "-") {
+        script_fd = open (script_file.c_str(), O_RDONLY);
+        if (script_fd < 0) {
+            complain() << script_file << ": " << strerror (errno) << endl;
+            return exit_status::get();
+        }
+    }
+    unique_ptr<line_reader> script;
+    unique_ptr<block_output> output;
+    streambuf* terminal = cout.rdbuf();
+    if (batch) {
+        script.reset (new line_reader (script_fd));
+        output.reset (new block_output (1));
+        cout.rdbuf (output.get());
+    } else {
+        cout << argv[0] << " build " << __DATE__ << " " << __TIME__
+             << endl;
+    }
+    bool need_echo = !batch && want_echo();
     
     // Use default constructor to create state of inode_state
     inode_state state;
+    if (!image_file.empty()) {
+        try {
+            state.load (image_file);
+        } catch (file_error& error) {
+            complain() << image_file << ": " << error.what() << endl;
+        }
+    }
+    if (!journal_file.empty()) {
+        try {
+            journal::open (state, journal_file, journal_sync, replay_record);
+        } catch (file_error& error) {
+            complain() << journal_file << ": " << error.what() << endl;
+        }
+    }
+    if (threads > 1) {
+        work_pool::start (threads);
+        reclaimer::start();
+    }
+    bool interactive = !batch && isatty (0);
+    
+    // Kept from line to line, so reading and splitting reuse their storage.
+    string line;
+    wordvec words;
     
     try {
         for (;;) {
             try {
-                // prompt() is actually get_prompt(), bad naming convention practice.
-                cout << state.prompt();
+                // Nothing typed before the prompt may be lost.
+                if (interactive) journal::commit();
                 
-                // Prepare to get input
-                string line;
-                getline (cin, line);
-                
-                // End of file, terminate the program.
-                if (cin.eof()) {
-                    // Bad if-statement. Should always include {}
-                    if (need_echo) cout << "^D";
-                    cout << endl;
-                    DEBUGF ('y', "EOF");
-                    break;
+                if (batch) {
+                    if (!script->next (line)) break;
+                } else {
+                    // prompt() is actually get_prompt(), bad naming convention practice.
+                    cout << state.prompt();
+                    
+                    // Prepare to get input
+                    getline (cin, line);
+                    
+                    // End of file, terminate the program.
+                    if (cin.eof()) {
+                        // Bad if-statement. Should always include {}
+                        if (need_echo) cout << "^D";
+                        cout << endl;
+                        DEBUGF ('y', "EOF");
+                        break;
+                    }
+                    
+                    // Print the user input on the terminal
+                    if (need_echo) cout << line << endl;
                 }
                 
-                // Print the user input on the terminal
-                if (need_echo) cout << line << endl;
-                
                 // Read input by splitting and searching.
                 try {
-                    wordvec words = split (line, " \t");
+                    split (line, " \t", words);
                     DEBUGF ('y', "words = " << words);
-                    command_fn fn = find_command_fn (words.at(0));
-                    
-                    // Excuate function or system throw command_error.
-                    fn (state, words);
+                    execute (state, words);
                 } catch (std::out_of_range) {
                     // Probably an empty input.
                 }
@@ -96,6 +182,14 @@ int main (int argc, char** argv) {
         // This catch intentionally left blank.
     }
     
+    reclaimer::stop();
+    work_pool::stop();
+    journal::close();
+    if (batch) {
+        output->write_out();
+        cout.rdbuf (terminal);
+        if (script_fd != 0) close (script_fd);
+    }
     return exit_status_message();
 }
 
@@ -0,0 +1,174 @@
+// $Id: pool.cpp,v 1.1 2016-04-07 13:36:11-07 - - $
+
+#include "pool.h"
+
+vector<unique_ptr<work_pool::task_queue>> work_pool::queues;
+vector<thread> work_pool::workers;
+mutex work_pool::idle_lock;
+condition_variable work_pool::wake;
+atomic<size_t> work_pool::queued {0};
+atomic<size_t> work_pool::running {0};
+bool work_pool::stopping {false};
+thread_local size_t work_pool::self {0};
+
+void work_pool::start (size_t threads) {
+    if (threads < 2 || enabled()) {
+        return;
+    }
+    for (size_t index = 0; index < threads; ++index) {
+        queues.push_back(make_unique<task_queue>());
+    }
+    for (size_t index = 1; index < threads; ++index) {
+        workers.emplace_back(work, index);
+    }
+}
+
+/**
+ * Takes this thread's newest task, or else steals another thread's
+ * oldest. The count of running tasks goes up before the queued count
+ * goes down, so wait() never sees both at zero while one is in hand.
+ */
+bool work_pool::take (task& next) {
+    size_t count = queues.size();
+    for (size_t step = 0; step < count; ++step) {
+        size_t index = (self + step) % count;
+        task_queue& queue = *queues[index];
+        lock_guard<mutex> guard (queue.lock);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (index == self) {
+            next = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            next = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        ++running;
+        --queued;
+        return true;
+    }
+    return false;
+}
+
+void work_pool::work (size_t index) {
+    self = index;
+    for (;;) {
+        task next;
+        if (take(next)) {
+            next();
+            next = nullptr;
+            --running;
+            continue;
+        }
+        unique_lock<mutex> guard (idle_lock);
+        wake.wait(guard, [] { return queued > 0 || stopping; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
+
+void work_pool::submit (task job) {
+    {
+        lock_guard<mutex> guard (queues[self]->lock);
+        queues[self]->tasks.push_back(move(job));
+        ++queued;
+    }
+    lock_guard<mutex> guard (idle_lock);
+    wake.notify_one();
+}
+
+bool work_pool::run_one() {
+    task next;
+    if (!take(next)) {
+        return false;
+    }
+    next();
+    next = nullptr;
+    --running;
+    return true;
+}
+
+void work_pool::wait() {
+    while (queued > 0 || running > 0) {
+        if (!run_one()) {
+            this_thread::yield();
+        }
+    }
+}
+
+void work_pool::stop() {
+    {
+        lock_guard<mutex> guard (idle_lock);
+        stopping = true;
+        wake.notify_all();
+    }
+    for (auto& worker: workers) {
+        worker.join();
+    }
+    workers.clear();
+    queues.clear();
+}
+
+
+const size_t reclaimer::batch_size;
+mutex reclaimer::lock;
+condition_variable reclaimer::wake;
+vector<inode_ptr> reclaimer::doomed;
+bool reclaimer::stopping {false};
+thread reclaimer::worker;
+
+void reclaimer::start() {
+    if (!enabled()) {
+        worker = thread(work);
+    }
+}
+
+void reclaimer::work() {
+    unique_lock<mutex> guard (lock);
+    for (;;) {
+        wake.wait(guard, [] {
+            return !doomed.empty() || content_index::backlog() || stopping;
+        });
+        if (stopping) {
+            return;
+        }
+        directory::release(doomed, batch_size);
+        content_index::update(batch_size);
+        // Let a waiting command in between batches.
+        guard.unlock();
+        this_thread::yield();
+        guard.lock();
+    }
+}
+
+void reclaimer::submit (inode_ptr subtree) {
+    doomed.push_back(move(subtree));
+    wake.notify_one();
+}
+
+void reclaimer::nudge() {
+    if (enabled()) {
+        wake.notify_one();
+    }
+}
+
+void reclaimer::finish() {
+    directory::release(doomed, doomed.max_size());
+}
+
+void reclaimer::stop() {
+    if (!enabled()) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard (lock);
+        stopping = true;
+        wake.notify_one();
+    }
+    worker.join();
+    lock_guard<mutex> guard (lock);
+    finish();
+}
+
@@ -0,0 +1,102 @@
+// $Id: pool.h,v 1.1 2016-04-07 13:36:11-07 - - $
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "file_sys.h"
+
+/**
+ *  Class work_pool
+ *  Static class. A work-stealing thread pool for the parallel
+ *  traversal mode (-t THREADS). Each thread has its own deque: it
+ *  takes its newest task from the back, and when that is empty,
+ *  steals the oldest task from the front of another's. The main
+ *  thread is slot 0 and runs tasks too, while it waits.
+ *
+ *  Tasks must not change the tree; see inode::print_contents().
+ *
+ *  Methods:
+ *  start()     Start THREADS - 1 workers. Fewer than 2 leaves the pool off.
+ *  enabled()   Whether the pool was started.
+ *  submit()    Queue a task on the calling thread's own deque.
+ *  run_one()   Run one queued task on this thread, if there is one.
+ *  wait()      Run or wait for tasks until none are queued or running.
+ *  stop()      Stop and join the workers.
+ */
+class work_pool {
+public:
+    using task = function<void()>;
+private:
+    struct task_queue {
+        mutex lock;
+        deque<task> tasks;
+    };
+    static vector<unique_ptr<task_queue>> queues;
+    static vector<thread> workers;
+    static mutex idle_lock;
+    static condition_variable wake;
+    static atomic<size_t> queued;
+    static atomic<size_t> running;
+    static bool stopping;
+    static thread_local size_t self;
+    static bool take (task& next);
+    static void work (size_t index);
+public:
+    static void start (size_t threads);
+    static bool enabled() { return !workers.empty(); };
+    static void submit (task job);
+    static bool run_one();
+    static void wait();
+    static void stop();
+};
+
+/**
+ *  Class reclaimer
+ *  Static class. Frees subtrees detached by rmr on a background
+ *  thread, so rmr returns at once. Freeing touches the same tables
+ *  as every command (slabs, names, blobs, stats), so the reclaimer
+ *  only works while it holds tree_lock(), which the shell holds for
+ *  the length of each command; it frees in small batches and lets go
+ *  in between. The same thread brings the content_index up to date.
+ *
+ *  Methods:
+ *  start()         Start the thread.
+ *  enabled()       Whether it was started.
+ *  tree_lock()     The lock around commands and reclaiming.
+ *  submit()        Hand over a subtree. Call with tree_lock() held.
+ *  nudge()         There are files to index. Call with tree_lock() held.
+ *  finish()        Free whatever is pending, now, on this thread.
+ *                  Call with tree_lock() held.
+ *  stop()          Finish and join the thread.
+ */
+class reclaimer {
+private:
+    static const size_t batch_size = 4096;
+    static mutex lock;
+    static condition_variable wake;
+    static vector<inode_ptr> doomed;
+    static bool stopping;
+    static thread worker;
+    static void work();
+public:
+    static void start();
+    static bool enabled() { return worker.joinable(); };
+    static mutex& tree_lock() { return lock; };
+    static void submit (inode_ptr subtree);
+    static void nudge();
+    static void finish();
+    static void stop();
+};
+
+#endif
+
@@ -0,0 +1,43 @@
+// $Id: slab.cpp,v 1.1 2016-04-07 13:36:11-07 - - $
+
+#include "slab.h"
+
+const size_t slab::blocks_per_chunk;
+
+/**
+ * Rounds the block size up so every block is suitably aligned for any
+ * type, and large enough to hold a free list link.
+ */
+static size_t aligned_size (size_t size) {
+    const size_t align = alignof(max_align_t);
+    if (size < sizeof(void*)) {
+        size = sizeof(void*);
+    }
+    return (size + align - 1) / align * align;
+}
+
+slab::slab (size_t size): block_size(aligned_size(size)) {
+}
+
+void* slab::allocate() {
+    if (free_list != nullptr) {
+        free_block* block = free_list;
+        free_list = block->next;
+        return block;
+    }
+    if (chunk_next == chunk_end) {
+        chunk_next = static_cast<char*>(::operator new(blocks_per_chunk * block_size));
+        chunk_end = chunk_next + blocks_per_chunk * block_size;
+        chunks.push_back(chunk_next);
+    }
+    void* block = chunk_next;
+    chunk_next += block_size;
+    return block;
+}
+
+void slab::deallocate (void* block) {
+    free_block* freed = static_cast<free_block*>(block);
+    freed->next = free_list;
+    free_list = freed;
+}
+
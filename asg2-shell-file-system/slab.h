@@ -0,0 +1,93 @@
+// $Id: slab.h,v 1.1 2016-04-07 13:36:11-07 - - $
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <cstddef>
+#include <new>
+#include <vector>
+using namespace std;
+
+/**
+ *  Class slab
+ *  A pool of fixed-size blocks carved out of large chunks. Freed blocks
+ *  go on a free list and are handed out again before a new chunk is
+ *  taken, so allocating and freeing are a few pointer moves each and
+ *  neighbouring blocks share cache lines.
+ *
+ *  Chunks are never returned to the heap.
+ *
+ *  Methods:
+ *  allocate()      One block, from the free list or the current chunk.
+ *  deallocate()    Put a block back on the free list.
+ *  chunk_bytes()   Bytes taken from the heap so far.
+ */
+class slab {
+private:
+    struct free_block {
+        free_block* next;
+    };
+    static const size_t blocks_per_chunk = 4096;
+    const size_t block_size;
+    free_block* free_list {nullptr};
+    char* chunk_next {nullptr};
+    char* chunk_end {nullptr};
+    vector<char*> chunks;
+public:
+    explicit slab (size_t size);
+    slab (const slab&) = delete;
+    slab& operator= (const slab&) = delete;
+    void* allocate();
+    void deallocate (void* block);
+    size_t chunk_bytes() const { return chunks.size() * blocks_per_chunk * block_size; };
+};
+
+/**
+ *  Class slab_allocator
+ *  A standard allocator that takes single objects from a slab shared by
+ *  every object of type T. Arrays go to the heap as usual.
+ *
+ *  With allocate_shared, T is the library's control block with the
+ *  object inside it, so both live in one slab block.
+ *
+ *  The slab is created on first use and never destroyed, so weak_ptrs
+ *  held in static tables can still give blocks back at exit.
+ */
+template <typename T>
+class slab_allocator {
+public:
+    using value_type = T;
+    slab_allocator() = default;
+    template <typename U>
+    slab_allocator (const slab_allocator<U>&) {};
+    static slab& pool() {
+        static slab* instance = new slab(sizeof(T));
+        return *instance;
+    };
+    T* allocate (size_t count) {
+        if (count != 1) {
+            return static_cast<T*>(::operator new(count * sizeof(T)));
+        }
+        return static_cast<T*>(pool().allocate());
+    };
+    void deallocate (T* block, size_t count) {
+        if (count != 1) {
+            ::operator delete(block);
+        } else {
+            pool().deallocate(block);
+        }
+    };
+};
+
+template <typename T, typename U>
+bool operator== (const slab_allocator<T>&, const slab_allocator<U>&) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!= (const slab_allocator<T>&, const slab_allocator<U>&) {
+    return false;
+}
+
+#endif
+
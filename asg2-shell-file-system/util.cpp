@@ -1,5 +1,9 @@
 // $Id: util.cpp,v 1.11 2016-01-13 16:21:53-08 - - $
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
 #include <cstdlib>
 #include <unistd.h>
 
@@ -28,6 +32,109 @@ string& execname() {
    return execname_string;
 }
 
+const size_t buffered_writer::block_size;
+
+buffered_writer::buffered_writer(): out (nullptr) {
+}
+
+buffered_writer::buffered_writer (ostream& out): out (&out) {
+   buffer.reserve (block_size + block_size / 4);
+}
+
+buffered_writer::~buffered_writer() {
+   flush();
+}
+
+void buffered_writer::flush() {
+   if (out == nullptr) return;
+   out->write (buffer.data(), buffer.size());
+   buffer.clear();
+}
+
+const size_t block_output::block_size;
+
+block_output::block_output (int fd): fd (fd), block (block_size) {
+   setp (block.data(), block.data() + block.size());
+}
+
+block_output::~block_output() {
+   write_out();
+}
+
+block_output::int_type block_output::overflow (int_type byte) {
+   write_out();
+   if (traits_type::eq_int_type (byte, traits_type::eof())) {
+      return traits_type::not_eof (byte);
+   }
+   *pptr() = traits_type::to_char_type (byte);
+   pbump (1);
+   return byte;
+}
+
+int block_output::sync() {
+   return 0;
+}
+
+void block_output::write_out() {
+   const char* next = pbase();
+   while (next < pptr()) {
+      ssize_t count = write (fd, next, pptr() - next);
+      if (count < 0) {
+         if (errno == EINTR) continue;
+         break;
+      }
+      next += count;
+   }
+   setp (block.data(), block.data() + block.size());
+}
+
+const size_t line_reader::block_size;
+
+line_reader::line_reader (int fd):
+             fd (fd), block (block_size), begin (0), end (0),
+             at_eof (false) {
+}
+
+bool line_reader::fill() {
+   if (at_eof) return false;
+   if (begin > 0) {
+      copy (block.begin() + begin, block.begin() + end, block.begin());
+      end -= begin;
+      begin = 0;
+   }
+   if (end == block.size()) block.resize (block.size() * 2);
+   for (;;) {
+      ssize_t count = read (fd, block.data() + end, block.size() - end);
+      if (count < 0 and errno == EINTR) continue;
+      if (count <= 0) {
+         at_eof = true;
+         return false;
+      }
+      end += count;
+      return true;
+   }
+}
+
+bool line_reader::next (string& line) {
+   size_t scanned = begin;
+   for (;;) {
+      const char* newline = static_cast<const char*> (
+            memchr (block.data() + scanned, '\n', end - scanned));
+      if (newline != nullptr) {
+         size_t stop = newline - block.data();
+         line.assign (block.data() + begin, stop - begin);
+         begin = stop + 1;
+         return true;
+      }
+      scanned = end - begin;
+      if (not fill()) break;
+   }
+   if (begin == end) return false;
+   line.assign (block.data() + begin, end - begin);
+   begin = end;
+   return true;
+}
+
 bool want_echo() {
    constexpr int CIN_FD {0};
    constexpr int COUT_FD {1};
@@ -41,18 +148,116 @@ bool want_echo() {
 
 wordvec split (const string& line, const string& delimiters) {
    wordvec words;
+   split (line, delimiters, words);
+   return words;
+}
+
+void split (const string& line, const string& delimiters,
+            wordvec& words) {
+   // Strings a shorter line did not need, kept for their buffers.
+   static thread_local wordvec spare;
+   size_t count = 0;
    size_t end = 0;
 
    // Loop over the string, splitting out words, and for each word
-   // thus found, append it to the output wordvec.
+   // thus found, store it in the next slot of the output wordvec.
    for (;;) {
       size_t start = line.find_first_not_of (delimiters, end);
       if (start == string::npos) break;
       end = line.find_first_of (delimiters, start);
-      words.push_back (line.substr (start, end - start));
+      size_t length = min (end, line.size()) - start;
+      if (count == words.size()) {
+         if (spare.empty()) {
+            words.emplace_back();
+         } else {
+            words.push_back (move (spare.back()));
+            spare.pop_back();
+         }
+      }
+      words[count].assign (line, start, length);
+      ++count;
+   }
+   while (words.size() > count) {
+      spare.push_back (move (words.back()));
+      words.pop_back();
    }
    DEBUGF ('u', words);
-   return words;
+}
+
+// Matches one [...] set at pattern[at], which is '['. Sets at to just
+// past the closing ']'; an unclosed '[' is taken as a literal.
+static bool match_set (const string& pattern, size_t& at, char letter) {
+   size_t next = at + 1;
+   bool negate = next < pattern.size()
+              and (pattern[next] == '!' or pattern[next] == '^');
+   if (negate) ++next;
+   bool matched = false;
+   size_t first = next;
+   while (next < pattern.size()
+          and (pattern[next] != ']' or next == first)) {
+      if (next + 2 < pattern.size() and pattern[next + 1] == '-'
+          and pattern[next + 2] != ']') {
+         if (pattern[next] <= letter and letter <= pattern[next + 2]) {
+            matched = true;
+         }
+         next += 3;
+      } else {
+         if (pattern[next] == letter) matched = true;
+         ++next;
+      }
+   }
+   if (next >= pattern.size()) {
+      ++at;
+      return letter == '[';
+   }
+   at = next + 1;
+   return matched != negate;
+}
+
+bool glob_match (const string& pattern, const string& name) {
+   size_t pat = 0;
+   size_t pos = 0;
+   size_t star_pat = string::npos;
+   size_t star_pos = 0;
+   while (pos < name.size()) {
+      if (pat < pattern.size() and pattern[pat] == '*') {
+         star_pat = ++pat;
+         star_pos = pos;
+         continue;
+      }
+      if (pat < pattern.size()) {
+         size_t next = pat;
+         bool matched;
+         if (pattern[pat] == '?') {
+            matched = true;
+            ++next;
+         } else if (pattern[pat] == '[') {
+            matched = match_set (pattern, next, name[pos]);
+         } else {
+            matched = pattern[pat] == name[pos];
+            ++next;
+         }
+         if (matched) {
+            pat = next;
+            ++pos;
+            continue;
+         }
+      }
+      // Mismatch: let the last * take one more character.
+      if (star_pat == string::npos) return false;
+      pat = star_pat;
+      pos = ++star_pos;
+   }
+   while (pat < pattern.size() and pattern[pat] == '*') ++pat;
+   return pat == pattern.size();
+}
+
+bool is_glob (const string& word) {
+   return word.find_first_of ("*?[") != string::npos;
+}
+
+bool is_word_char (char chr) {
+   return isalnum (static_cast<unsigned char> (chr)) or chr == '_';
 }
 
 ostream& complain() {
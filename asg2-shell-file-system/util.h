@@ -59,6 +59,31 @@ class exit_status {
 
 wordvec split (const string& line, const string& delimiter);
 
+// split (into words) -
+//    The same, into a wordvec the caller keeps from line to line.
+//    Words are assigned over the strings already there.  A shorter
+//    line parks the extra strings, buffers and all, for a longer one
+//    to take back, so once the vector and its strings have grown,
+//    splitting allocates nothing however the word count varies.
+
+void split (const string& line, const string& delimiter, wordvec& words);
+
+// glob_match -
+//    Whether a name matches a shell pattern: * matches any run of
+//    characters, ? any one, and [...] any one of a set, with ranges
+//    (a-z) and ! or ^ to negate.
+// is_glob -
+//    Whether a word has any of those special characters.
+
+bool glob_match (const string& pattern, const string& name);
+bool is_glob (const string& word);
+
+// is_word_char -
+//    Whether a char can be part of a token for grep: a letter, a
+//    digit or an underscore.
+
+bool is_word_char (char chr);
+
 // complain -
 //    Used for starting error messages.  Sets the exit status to
 //    EXIT_FAILURE, writes the program name to cerr, and then
@@ -67,6 +92,90 @@ wordvec split (const string& line, const string& delimiter);
 
 ostream& complain();
 
+// buffered_writer -
+//    Collects output in a string and writes it to an ostream in
+//    large blocks, so a long listing does not flush once per line.
+//    Whatever is left is written when the writer is destroyed.
+//    Made with no ostream, it only collects, into str().
+
+class buffered_writer {
+   private:
+      static const size_t block_size = 1 << 16;
+      ostream* out;
+      string buffer;
+   public:
+      buffered_writer();
+      explicit buffered_writer (ostream& out);
+      buffered_writer (const buffered_writer&) = delete;
+      buffered_writer& operator= (const buffered_writer&) = delete;
+      ~buffered_writer();
+      buffered_writer& operator<< (const string& text) {
+         buffer += text;
+         if (buffer.size() >= block_size) flush();
+         return *this;
+      }
+      buffered_writer& operator<< (const char* text) {
+         buffer += text;
+         if (buffer.size() >= block_size) flush();
+         return *this;
+      }
+      buffered_writer& operator<< (char text) {
+         buffer += text;
+         return *this;
+      }
+      buffered_writer& operator<< (size_t number) {
+         return *this << to_string (number);
+      }
+      buffered_writer& operator<< (int number) {
+         return *this << to_string (number);
+      }
+      void flush();
+      string& str() { return buffer; }
+};
+
+// block_output -
+//    A stream buffer for batch runs.  Output collects in one large
+//    block written to the descriptor only when it fills, on an
+//    explicit write_out(), or when the buffer is destroyed.  Flushing
+//    the stream, as endl does, writes nothing.
+
+class block_output: public streambuf {
+   private:
+      static const size_t block_size = 1 << 20;
+      int fd;
+      vector<char> block;
+   protected:
+      int_type overflow (int_type byte) override;
+      int sync() override;
+   public:
+      explicit block_output (int fd);
+      block_output (const block_output&) = delete;
+      block_output& operator= (const block_output&) = delete;
+      ~block_output();
+      void write_out();
+};
+
+// line_reader -
+//    Reads a descriptor a large block at a time and hands it out a
+//    line at a time, without the trailing newline.  A last line with
+//    no newline is still returned.  next returns false at end of file.
+
+class line_reader {
+   private:
+      static const size_t block_size = 1 << 20;
+      int fd;
+      vector<char> block;
+      size_t begin;
+      size_t end;
+      bool at_eof;
+      bool fill();
+   public:
+      explicit line_reader (int fd);
+      line_reader (const line_reader&) = delete;
+      line_reader& operator= (const line_reader&) = delete;
+      bool next (string& line);
+};
+
 // operator<< (vector) -
 //    An overloaded template operator which allows vectors to be
 //    printed out as a single operator, each element separated from